@@ -10,10 +10,12 @@ namespace CGL {
 typedef double CGLfloat;
 
 class Vector2D;
+class Vector2f;
 class Vector3D;
 class Vector4D;
 
 class Matrix3x3;
+class Matrix2x3;
 class Matrix4x4;
 
 class Quaternion;
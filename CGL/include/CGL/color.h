@@ -11,6 +11,10 @@ namespace CGL {
  * Encodes a color via additive red, green, and blue chanel values.
  * Each color chanel value is in the range [0,1]. The alpha value
  * defines the transparency of the color and is also in [0,1].
+ *
+ * Colors are premultiplied: r, g and b are already scaled by a, so a
+ * color with opacity t is c * t, and the arithmetic below interpolates
+ * translucent colors correctly.
  */
 class Color {
  public:
@@ -19,6 +23,7 @@ class Color {
   float r; /**< value of red chanel   */
   float g; /**< value of green chanel */
   float b; /**< value of blue chanel  */
+  float a; /**< value of alpha chanel */
 
   // constants
   static const Color White;
@@ -30,13 +35,14 @@ class Color {
    * \param r Value of the red chanel.
    * \param g Value of the green chanel.
    * \param b Value of the blue chanel.
+   * \param a Value of the alpha chanel, opaque by default.
    */
-  Color( float r = 0, float g = 0, float b = 0 )
-      : r( r ), g( g ), b( b ) { }
+  Color( float r = 0, float g = 0, float b = 0, float a = 1 )
+      : r( r ), g( g ), b( b ), a( a ) { }
 
   /**
    * Constructor.
-   * Initialize from array of 8-bit component values (RGB).
+   * Initialize from array of 8-bit component values (RGB), opaque.
    * \param arr Array containing component values.
    */
   Color( const unsigned char* arr );
@@ -51,37 +57,37 @@ class Color {
 
   // Addition.
   inline Color operator+( const Color& rhs ) const {
-    return Color( r + rhs.r, g + rhs.g, b + rhs.b);
+    return Color( r + rhs.r, g + rhs.g, b + rhs.b, a + rhs.a );
   }
 
   inline Color& operator+=( const Color& rhs ) {
-    r += rhs.r; g += rhs.g; b += rhs.b;
+    r += rhs.r; g += rhs.g; b += rhs.b; a += rhs.a;
     return *this;
   }
 
   // Vector multiplication.
   inline Color operator*( const Color& rhs ) const {
-    return Color( r * rhs.r, g * rhs.g, b * rhs.b);
+    return Color( r * rhs.r, g * rhs.g, b * rhs.b, a * rhs.a );
   }
 
   inline Color& operator*=( const Color& rhs ) {
-    r *= rhs.r; g *= rhs.g; b *= rhs.b;
+    r *= rhs.r; g *= rhs.g; b *= rhs.b; a *= rhs.a;
     return *this;
   }
 
   // Scalar multiplication.
   inline Color operator*( float s ) const {
-    return Color( r * s, g * s, b * s );
+    return Color( r * s, g * s, b * s, a * s );
   }
 
   inline Color& operator*=( float s ) {
-    r *= s; g *= s; b *= s;
+    r *= s; g *= s; b *= s; a *= s;
     return *this;
   }
 
   // comparison
   inline bool operator==( const Color& rhs ) const {
-    return r == rhs.r && g == rhs.g && b == rhs.b;
+    return r == rhs.r && g == rhs.g && b == rhs.b && a == rhs.a;
   }
 
   inline bool operator!=( const Color& rhs ) const {
@@ -101,6 +107,15 @@ class Color {
    */
   std::string toHex( ) const;
 
+  /**
+   * Porter-Duff source over: composites this color over dst.
+   * \return this + dst * (1 - a).
+   */
+  inline Color over( const Color& dst ) const {
+    float k = 1 - a;
+    return Color( r + dst.r * k, g + dst.g * k, b + dst.b * k, a + dst.a * k );
+  }
+
 
 }; // class Color
 
@@ -0,0 +1,122 @@
+#ifndef CGL_MATRIX2X3_H
+#define CGL_MATRIX2X3_H
+
+#include "CGL.h"
+#include "vector2D.h"
+#include "vector2f.h"
+#include "matrix3x3.h"
+
+#include <cstddef>
+#include <cassert>
+
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+namespace CGL {
+
+/**
+ * Defines a 2D affine transform.
+ * This is a 3x3 homogeneous matrix whose bottom row is (0, 0, w): the top
+ * two rows are stored as is, and w is kept as a scale that divides the
+ * result. When w is 1 the divide is skipped entirely.
+ *
+ * Points are transformed in double precision and returned as Vector2f,
+ * which gives exactly the coordinates the rasterizer used to receive from
+ * Matrix3x3 * Vector2D after narrowing to float.
+ */
+class Matrix2x3 {
+
+  public:
+
+  // row major entries
+  double m00, m01, m02;
+  double m10, m11, m12;
+
+  // homogeneous scale
+  double w;
+
+  // The default constructor. Returns identity.
+  Matrix2x3( void ) : m00( 1 ), m01( 0 ), m02( 0 ),
+                      m10( 0 ), m11( 1 ), m12( 0 ), w( 1 ) { }
+
+  /**
+   * Constructor from an affine 3x3 matrix.
+   * REQUIRES: is_affine(m). The bottom row is not kept, so a projective
+   * m would transform points wrongly; it is caught by an assertion.
+   */
+  explicit Matrix2x3( const Matrix3x3& m )
+    : m00( m(0,0) ), m01( m(0,1) ), m02( m(0,2) ),
+      m10( m(1,0) ), m11( m(1,1) ), m12( m(1,2) ), w( m(2,2) ) {
+    assert( is_affine( m ) );
+  }
+
+  /**
+   * Returns true if m has no projective component, i.e. its bottom row is
+   * (0, 0, w) for some nonzero w.
+   */
+  static inline bool is_affine( const Matrix3x3& m ) {
+    return m(2,0) == 0 && m(2,1) == 0 && m(2,2) != 0;
+  }
+
+  // determinant of the linear part, i.e. the factor areas are scaled by
+  inline double det( void ) const {
+    return ( m00 * m11 - m01 * m10 ) / ( w * w );
+  }
+
+  // transforms a point
+  inline Vector2f operator*( const Vector2D& v ) const {
+    double x = v.x * m00 + v.y * m01 + m02;
+    double y = v.x * m10 + v.y * m11 + m12;
+    if (w != 1) { x /= w; y /= w; }
+    return Vector2f( (float) x, (float) y );
+  }
+
+  // transforms a single precision point
+  inline Vector2f operator*( const Vector2f& v ) const {
+    return (*this) * Vector2D( v.x, v.y );
+  }
+
+  /**
+   * Transforms n points from in to out. Each point gives the same result
+   * as operator*. With AVX, two points (four doubles) are transformed per
+   * instruction and narrowed to floats together.
+   */
+  inline void transform( const Vector2D* in, Vector2f* out, size_t n ) const {
+    size_t i = 0;
+#ifdef __AVX__
+    // With v = (x0 y0 x1 y1) and s = v with each pair swapped,
+    // out = (v * (m00 m11 ..) + s * (m01 m10 ..) + (m02 m12 ..)) / w
+    __m256d diag = _mm256_setr_pd( m00, m11, m00, m11 );
+    __m256d off  = _mm256_setr_pd( m01, m10, m01, m10 );
+    __m256d t    = _mm256_setr_pd( m02, m12, m02, m12 );
+    __m256d ws   = _mm256_set1_pd( w );
+    const double* src = reinterpret_cast<const double*>( in );
+    float* dst = reinterpret_cast<float*>( out );
+    if (w == 1) {
+      for (; i + 2 <= n; i += 2) {
+        __m256d v = _mm256_loadu_pd( src + 2 * i );
+        __m256d s = _mm256_permute_pd( v, 0x5 );
+        __m256d r = _mm256_add_pd( _mm256_mul_pd( v, diag ), _mm256_mul_pd( s, off ) );
+        _mm_storeu_ps( dst + 2 * i, _mm256_cvtpd_ps( _mm256_add_pd( r, t ) ) );
+      }
+    } else {
+      for (; i + 2 <= n; i += 2) {
+        __m256d v = _mm256_loadu_pd( src + 2 * i );
+        __m256d s = _mm256_permute_pd( v, 0x5 );
+        __m256d r = _mm256_add_pd( _mm256_mul_pd( v, diag ), _mm256_mul_pd( s, off ) );
+        r = _mm256_div_pd( _mm256_add_pd( r, t ), ws );
+        _mm_storeu_ps( dst + 2 * i, _mm256_cvtpd_ps( r ) );
+      }
+    }
+#endif
+    for (; i < n; ++i) {
+      out[i] = (*this) * in[i];
+    }
+  }
+
+}; // class Matrix2x3
+
+} // namespace CGL
+
+#endif // CGL_MATRIX2X3_H
@@ -0,0 +1,152 @@
+#ifndef CGL_VECTOR2F_H
+#define CGL_VECTOR2F_H
+
+#include "CGL.h"
+#include "vector2D.h"
+
+#include <ostream>
+#include <cmath>
+
+namespace CGL {
+
+/**
+ * Defines single precision 2D vectors.
+ * Mirrors Vector2D for the rasterization path, where coordinates end up as
+ * floats anyway. Arrays of Vector2f are tightly packed (x0 y0 x1 y1 ...),
+ * so they can be loaded directly into SIMD registers.
+ */
+class Vector2f {
+ public:
+
+  // components
+  float x, y;
+
+  /**
+   * Constructor.
+   * Initializes to vector (0,0).
+   */
+  Vector2f() : x( 0.0f ), y( 0.0f ) { }
+
+  /**
+   * Constructor.
+   * Initializes to vector (a,b).
+   */
+  Vector2f( float x, float y ) : x( x ), y( y ) { }
+
+  /**
+   * Constructor.
+   * Narrows a double precision vector.
+   */
+  explicit Vector2f( const Vector2D& v ) : x( (float) v.x ), y( (float) v.y ) { }
+
+  // returns reference to the specified component (0-based indexing: x, y)
+  inline float& operator[] ( const int& index ) {
+    return ( &x )[ index ];
+  }
+
+  // returns const reference to the specified component (0-based indexing: x, y)
+  inline const float& operator[] ( const int& index ) const {
+    return ( &x )[ index ];
+  }
+
+  // widens to a double precision vector
+  inline Vector2D to_double( void ) const {
+    return Vector2D( x, y );
+  }
+
+  // additive inverse
+  inline Vector2f operator-( void ) const {
+    return Vector2f( -x, -y );
+  }
+
+  // addition
+  inline Vector2f operator+( const Vector2f& v ) const {
+    return Vector2f( x + v.x, y + v.y );
+  }
+
+  // subtraction
+  inline Vector2f operator-( const Vector2f& v ) const {
+    return Vector2f( x - v.x, y - v.y );
+  }
+
+  // right scalar multiplication
+  inline Vector2f operator*( float r ) const {
+    return Vector2f( x * r, y * r );
+  }
+
+  // scalar division
+  inline Vector2f operator/( float r ) const {
+    return Vector2f( x / r, y / r );
+  }
+
+  // add v
+  inline void operator+=( const Vector2f& v ) {
+    x += v.x;
+    y += v.y;
+  }
+
+  // subtract v
+  inline void operator-=( const Vector2f& v ) {
+    x -= v.x;
+    y -= v.y;
+  }
+
+  // scalar multiply by r
+  inline void operator*=( float r ) {
+    x *= r;
+    y *= r;
+  }
+
+  // scalar divide by r
+  inline void operator/=( float r ) {
+    x /= r;
+    y /= r;
+  }
+
+  /**
+   * Returns norm.
+   */
+  inline float norm( void ) const {
+    return sqrtf( x*x + y*y );
+  }
+
+  /**
+   * Returns norm squared.
+   */
+  inline float norm2( void ) const {
+    return x*x + y*y;
+  }
+
+  /**
+   * Returns unit vector parallel to this one.
+   */
+  inline Vector2f unit( void ) const {
+    return *this / this->norm();
+  }
+
+}; // class Vector2f
+
+// left scalar multiplication
+inline Vector2f operator*( float r, const Vector2f& v ) {
+   return v*r;
+}
+
+// inner product
+inline float dot( const Vector2f& v1, const Vector2f& v2 ) {
+  return v1.x*v2.x + v1.y*v2.y;
+}
+
+// cross product
+inline float cross( const Vector2f& v1, const Vector2f& v2 ) {
+  return v1.x*v2.y - v1.y*v2.x;
+}
+
+// prints components
+inline std::ostream& operator<<( std::ostream& os, const Vector2f& v ) {
+  os << "(" << v.x << "," << v.y << ")";
+  return os;
+}
+
+} // namespace CGL
+
+#endif // CGL_VECTOR2F_H
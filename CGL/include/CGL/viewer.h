@@ -5,6 +5,7 @@
 #include "osdtext.h"
 
 #include <chrono>
+#include <vector>
 
 #include "GLFW/glfw3.h"
 
@@ -110,6 +111,9 @@ class Viewer {
   static int line_id_renderer;
   static int line_id_framerate;
 
+  // lines below the renderer line, for renderer info of several lines
+  static std::vector<int> line_ids_info;
+
 
 }; // class Viewer
 
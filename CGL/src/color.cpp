@@ -18,6 +18,7 @@ Color::Color( const unsigned char* arr ) {
   r = arr[0] * inv;
   g = arr[1] * inv;
   b = arr[2] * inv;
+  a = 1;
 }
 
 Color Color::fromHex( const char* s ) {
@@ -60,6 +61,7 @@ std::ostream& operator<<( std::ostream& os, const Color& c ) {
   os << "(r=" << c.r;
   os << " g=" << c.g;
   os << " b=" << c.b;
+  os << " a=" << c.a;
   os << ")";
   return os;
 }
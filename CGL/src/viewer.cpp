@@ -41,6 +41,7 @@ Renderer* Viewer::renderer;
 OSDText* Viewer::osd_text;
 int Viewer::line_id_renderer;
 int Viewer::line_id_framerate;
+std::vector<int> Viewer::line_ids_info;
 
 Viewer::Viewer() {
 
@@ -203,8 +204,24 @@ void Viewer::drawInfo() {
   // The viewer should only update when the renderer needs to
   // update the info text. 
   if (renderer) {
+    // each line of the info goes on an OSD line of its own, the first one
+    // in the renderer line, the rest below it in smaller type
     string renderer_info = renderer->info();
-    osd_text->set_text(line_id_renderer, renderer_info);
+    size_t end = renderer_info.find('\n');
+    osd_text->set_text(line_id_renderer, renderer_info.substr(0, end));
+    for (size_t i = 0; end != string::npos || i < line_ids_info.size(); ++i) {
+      string line;
+      if (end != string::npos) {
+        size_t start = end + 1;
+        end = renderer_info.find('\n', start);
+        line = renderer_info.substr(start, end == string::npos ? end : end - start);
+      }
+      if (i == line_ids_info.size()) {
+        line_ids_info.push_back(osd_text->add_line(-0.95, 0.85 - 0.05 * i, "",
+                                                   14, Color(0.15, 0.5, 0.15)));
+      }
+      osd_text->set_text(line_ids_info[i], line);
+    }
   } else {
     string renderer_info = "No input renderer";
     osd_text->set_text(line_id_renderer, renderer_info);
@@ -0,0 +1,96 @@
+#ifndef CGL_BENCH_WORKLOADS_H
+#define CGL_BENCH_WORKLOADS_H
+
+// Seeded random workloads shared by the benchmarks. Every run draws the
+// same primitives from the same seed, so timings can be compared across
+// runs and across changes.
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+namespace CGL {
+
+// Linear congruential generator with a fixed seed
+class BenchRandom {
+ public:
+  explicit BenchRandom(unsigned int seed = 12345) : state(seed) { }
+
+  // The next 32 bits of state
+  unsigned int next_bits() {
+    state = state * 1664525u + 1013904223u;
+    return state;
+  }
+
+  // Uniform in [0, 1)
+  float next() { return (next_bits() >> 8) / 16777216.0f; }
+
+ private:
+  unsigned int state;
+};
+
+// count triangles as x y pairs, six floats each. Each is centered on a
+// random point of a screen x screen square, with its vertices up to half
+// of size * screen away on either axis. Lines use the first two vertices.
+inline std::vector<float> random_triangles(size_t count, size_t screen, float size,
+                                           unsigned int seed = 12345) {
+  std::vector<float> points(6 * count);
+  BenchRandom rnd(seed);
+  for (size_t i = 0; i < count; ++i) {
+    float cx = rnd.next() * screen, cy = rnd.next() * screen;
+    for (int k = 0; k < 3; ++k) {
+      points[6 * i + 2 * k]     = cx + (rnd.next() - 0.5f) * size * screen;
+      points[6 * i + 2 * k + 1] = cy + (rnd.next() - 0.5f) * size * screen;
+    }
+  }
+  return points;
+}
+
+// count slivers, laid out as random_triangles: a long edge of up to
+// size * screen in a random direction, and a third vertex half a pixel off
+// its middle
+inline std::vector<float> random_slivers(size_t count, size_t screen, float size,
+                                         unsigned int seed = 12345) {
+  std::vector<float> points(6 * count);
+  BenchRandom rnd(seed);
+  float extent = size * screen;
+  for (size_t i = 0; i < count; ++i) {
+    float cx = rnd.next() * screen, cy = rnd.next() * screen;
+    float dx = (rnd.next() - 0.5f) * extent, dy = (rnd.next() - 0.5f) * extent;
+    float len = std::max(1e-3f, std::sqrt(dx * dx + dy * dy));
+    float* p = &points[6 * i];
+    p[0] = cx - dx / 2; p[1] = cy - dy / 2;
+    p[2] = cx + dx / 2; p[3] = cy + dy / 2;
+    p[4] = cx - 0.5f * dy / len; p[5] = cy + 0.5f * dx / len;
+  }
+  return points;
+}
+
+// Texture coordinates for triangles from random_triangles, six floats
+// each, that follow screen position so a pixel spans texels_per_pixel
+// texels of a texture_size texture, starting from a random point of it.
+// size is the size the triangles were made with.
+inline std::vector<float> random_uvs(const std::vector<float>& points, size_t screen, float size,
+                                     float texels_per_pixel, size_t texture_size,
+                                     unsigned int seed = 12345) {
+  std::vector<float> uvs(points.size());
+  BenchRandom rnd(seed);
+  float scale = texels_per_pixel / texture_size;
+  float span = std::min(1.0f, size * screen * scale);
+  for (size_t i = 0; i < points.size(); i += 6) {
+    const float* p = &points[i];
+    float x0 = std::min(std::min(p[0], p[2]), p[4]);
+    float y0 = std::min(std::min(p[1], p[3]), p[5]);
+    float u0 = rnd.next() * (1 - span), v0 = rnd.next() * (1 - span);
+    for (int k = 0; k < 3; ++k) {
+      uvs[i + 2 * k]     = u0 + (p[2 * k] - x0) * scale;
+      uvs[i + 2 * k + 1] = v0 + (p[2 * k + 1] - y0) * scale;
+    }
+  }
+  return uvs;
+}
+
+} // namespace CGL
+
+#endif // CGL_BENCH_WORKLOADS_H
@@ -0,0 +1,98 @@
+// Compares rasterization throughput of opaque and translucent primitives.
+//
+// Opaque colors take the store-only path in the rasterizer, translucent ones
+// are composited source-over into the sample buffer. Each workload is a
+// fixed, seeded set of random primitives drawn once with an opaque color and
+// once with the same color at half opacity, at each sample rate.
+//
+// usage: blend_bench [screen size] [primitives] [iterations]
+
+#include "CGL/CGL.h"
+#include "CGL/timer.h"
+#include "rasterizer.h"
+#include "bench_workloads.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+using namespace CGL;
+
+enum Workload { TRIANGLES, INTERPOLATED, LINES, SMOOTH_LINES };
+
+struct Config {
+  const char* name;
+  Workload workload;
+  float size;   // extent of each primitive, as a fraction of the screen
+};
+
+static const Config configs[] = {
+  { "small triangles",    TRIANGLES,    0.02f },
+  { "large triangles",    TRIANGLES,    0.5f  },
+  { "interpolated tris",  INTERPOLATED, 0.2f  },
+  { "lines",              LINES,        0.5f  },
+  { "smooth lines",       SMOOTH_LINES, 0.5f  },
+};
+
+static const unsigned int rates[] = { 1, 4, 16 };
+
+// Returns nanoseconds per primitive
+static double run(RasterizerImp& r, const Config& c, const vector<float>& p,
+                  float alpha, int iterations) {
+  Color color = Color(0.2f, 0.4f, 0.8f) * alpha;
+  Color c1 = Color(0.8f, 0.2f, 0.1f) * alpha, c2 = Color(0.1f, 0.9f, 0.3f) * alpha;
+  size_t count = p.size() / 6;
+
+  r.set_stroke_mode(c.workload == SMOOTH_LINES ? S_SMOOTH_HAIRLINE : S_HAIRLINE);
+
+  Timer timer;
+  timer.start();
+  for (int it = 0; it < iterations; ++it) {
+    r.clear_buffers();
+    for (size_t i = 0; i < count; ++i) {
+      const float* v = &p[6 * i];
+      switch (c.workload) {
+        case TRIANGLES:
+          r.rasterize_triangle(v[0], v[1], v[2], v[3], v[4], v[5], color);
+          break;
+        case INTERPOLATED:
+          r.rasterize_interpolated_color_triangle(v[0], v[1], color, v[2], v[3], c1, v[4], v[5], c2);
+          break;
+        case LINES:
+        case SMOOTH_LINES:
+          r.rasterize_line(v[0], v[1], v[2], v[3], color);
+          break;
+      }
+    }
+  }
+  timer.stop();
+
+  return timer.duration() * 1e9 / ((double)count * iterations);
+}
+
+int main(int argc, char** argv) {
+  size_t screen = argc > 1 ? atoi(argv[1]) : 512;
+  size_t count = argc > 2 ? atoi(argv[2]) : 2000;
+  int iterations = argc > 3 ? atoi(argv[3]) : 3;
+
+  vector<unsigned char> framebuffer(3 * screen * screen);
+  RasterizerImp r(P_NEAREST, L_ZERO, screen, screen, 1);
+  r.set_framebuffer_target(framebuffer.data(), screen, screen);
+
+  printf("%zux%zu screen, %zu primitives, %d iterations\n", screen, screen, count, iterations);
+  printf("%-20s %5s %14s %14s %8s\n", "config", "rate", "opaque ns/prim", "blend ns/prim", "ratio");
+
+  for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); ++i) {
+    vector<float> points = random_triangles(count, screen, configs[i].size);
+    for (size_t j = 0; j < sizeof(rates) / sizeof(rates[0]); ++j) {
+      r.set_sample_rate(rates[j]);
+      double t_opaque = run(r, configs[i], points, 1, iterations);
+      double t_blend = run(r, configs[i], points, 0.5f, iterations);
+      printf("%-20s %5u %14.1f %14.1f %7.2fx\n", configs[i].name, rates[j],
+             t_opaque, t_blend, t_blend / t_opaque);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,313 @@
+// Times each stage of drawing the SVG corpus, for tracking regressions.
+//
+// Every .svg file under the given directory is drawn the way the viewer
+// draws it: centered, with the retained display list on, for each
+// combination of resolution, sample rate and sampling methods asked for.
+// Each stage is timed separately for every iteration:
+//
+//   parse        loading the file, including decoding its textures, which
+//                are purged from the texture cache after every iteration
+//   triangulate  transforming, triangulating and tessellating the elements
+//                into the display list
+//   rasterize    drawing the display list into the sample buffer
+//   resolve      averaging the sample buffer into the framebuffer
+//   encode       writing the framebuffer to an image file
+//
+// The display list is drawn with draw_pending before resolving, so that
+// rasterize and resolve are each timed on their own. The median and 95th percentile of each stage, in milliseconds, are
+// printed as JSON.
+//
+// usage: draw_bench [options] [svg directory]
+//   -s sizes        comma separated, each N or WxH         (default 800)
+//   -r rates        comma separated samples per pixel, each
+//                   1, 4, 9 or 16                          (default 1,4,16)
+//   -p methods      pixel sampling: nearest, linear        (default nearest)
+//   -l methods      level sampling: zero, nearest, linear,
+//                   anisotropic                            (default zero)
+//   -n iterations                                          (default 5)
+//   -f format       png, ppm, pam or qoi                   (default png)
+//   -c level        PNG compression level, -1 for lodepng  (default -1)
+//   -o file         where the encoded images go            (default
+//                   draw_bench.out, removed at the end)
+
+#include "CGL/CGL.h"
+#include "CGL/timer.h"
+#include "svg.h"
+#include "svgparser.h"
+#include "texture_cache.h"
+#include "rasterizer.h"
+#include "image_writer.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace std;
+using namespace CGL;
+
+static const char* pixel_names[] = { "nearest", "linear" };
+static const char* level_names[] = { "zero", "nearest", "linear", "anisotropic" };
+
+enum Stage { PARSE, TRIANGULATE, RASTERIZE, RESOLVE, ENCODE, TOTAL, STAGES };
+static const char* stage_names[] = { "parse", "triangulate", "rasterize", "resolve", "encode", "total" };
+
+struct Size {
+  size_t width, height;
+};
+
+static vector<string> split(const char* list) {
+  vector<string> items;
+  string s = list;
+  size_t start = 0;
+  while (start <= s.size()) {
+    size_t end = s.find(',', start);
+    if (end == string::npos) end = s.size();
+    if (end > start) items.push_back(s.substr(start, end - start));
+    start = end + 1;
+  }
+  return items;
+}
+
+// Index of name in names, or -1
+static int lookup(const string& name, const char** names, int count) {
+  for (int i = 0; i < count; ++i) {
+    if (name == names[i]) return i;
+  }
+  return -1;
+}
+
+// Every .svg file under path, sorted
+static void find_svgs(const string& path, vector<string>& files) {
+  DIR* dir = opendir(path.c_str());
+  if (!dir) return;
+  struct dirent* ent;
+  while ((ent = readdir(dir)) != NULL) {
+    string name = ent->d_name;
+    if (name == "." || name == "..") continue;
+    string full = path + "/" + name;
+    struct stat st;
+    if (stat(full.c_str(), &st) < 0) continue;
+    if (S_ISDIR(st.st_mode)) {
+      find_svgs(full, files);
+    } else if (name.size() > 4 && name.compare(name.size() - 4, 4, ".svg") == 0) {
+      files.push_back(full);
+    }
+  }
+  closedir(dir);
+  sort(files.begin(), files.end());
+}
+
+// The transform the viewer starts out with for svg on a w x h screen: the
+// canvas centered, with a bit of margin
+static Matrix3x3 initial_view(const SVG& svg, size_t w, size_t h) {
+  float span = 1.2f * max(svg.width, svg.height) / 2;
+  float x = svg.width / 2, y = svg.height / 2;
+  Matrix3x3 svg_to_ndc(1, 0, -x + span, 0, 1, -y + span, 0, 0, 2 * span);
+
+  Matrix3x3 ndc_to_screen;
+  float scale = min(w, h);
+  ndc_to_screen(0, 0) = scale; ndc_to_screen(0, 2) = (w - scale) / 2;
+  ndc_to_screen(1, 1) = scale; ndc_to_screen(1, 2) = (h - scale) / 2;
+  return ndc_to_screen * svg_to_ndc;
+}
+
+// Nearest rank percentile p of sorted values
+static double percentile(const vector<double>& sorted, double p) {
+  size_t rank = (size_t)ceil(p / 100 * sorted.size());
+  return sorted[min(sorted.size(), max((size_t)1, rank)) - 1];
+}
+
+// Draws path with the given settings iterations times. Fills times with the
+// milliseconds of each stage per iteration; returns false if the file
+// could not be loaded.
+static bool run(const string& path, const Size& size, unsigned int rate,
+                PixelSampleMethod psm, LevelSampleMethod lsm, int iterations,
+                const string& output, const ImageWriteOptions& options,
+                vector<double> times[STAGES]) {
+  vector<unsigned char> framebuffer(3 * size.width * size.height);
+  RasterizerImp r(psm, lsm, size.width, size.height, rate);
+  r.set_retained(true);
+  r.set_framebuffer_target(framebuffer.data(), size.width, size.height);
+
+  Timer timer;
+  for (int it = 0; it < iterations; ++it) {
+    double t[STAGES];
+
+    timer.start();
+    SVG* svg = new SVG();
+    int loaded = SVGParser::load(path.c_str(), svg);
+    timer.stop();
+    t[PARSE] = timer.duration();
+    if (loaded < 0) {
+      delete svg;
+      TextureCache::purge();
+      return false;
+    }
+
+    r.clear_buffers();
+    timer.start();
+    svg->draw(&r, initial_view(*svg, size.width, size.height));
+    timer.stop();
+    t[TRIANGULATE] = timer.duration();
+
+    timer.start();
+    r.draw_pending();
+    timer.stop();
+    t[RASTERIZE] = timer.duration();
+
+    timer.start();
+    r.resolve_to_framebuffer();
+    timer.stop();
+    t[RESOLVE] = timer.duration();
+
+    timer.start();
+    write_image(output, framebuffer.data(), size.width, size.height, options);
+    timer.stop();
+    t[ENCODE] = timer.duration();
+
+    // the next iteration decodes the textures again rather than finding
+    // them in the cache
+    delete svg;
+    TextureCache::purge();
+
+    t[TOTAL] = t[PARSE] + t[TRIANGULATE] + t[RASTERIZE] + t[RESOLVE] + t[ENCODE];
+    for (int s = 0; s < STAGES; ++s) times[s].push_back(t[s] * 1000);
+  }
+  return true;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: draw_bench [-s sizes] [-r rates] [-p methods] [-l methods]\n"
+                  "                  [-n iterations] [-f format] [-c level] [-o file] [svg directory]\n");
+}
+
+int main(int argc, char** argv) {
+  string root = "svg";
+  vector<Size> sizes(1, Size{ 800, 800 });
+  vector<unsigned int> rates = { 1, 4, 16 };
+  vector<PixelSampleMethod> psms(1, P_NEAREST);
+  vector<LevelSampleMethod> lsms(1, L_ZERO);
+  int iterations = 5;
+  string output = "draw_bench.out";
+  ImageWriteOptions options;
+
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg.size() != 2 || arg[0] != '-') {
+      root = arg;
+      continue;
+    }
+    if (i + 1 == argc) {
+      usage();
+      return 1;
+    }
+    const char* value = argv[++i];
+    vector<string> items = split(value);
+    switch (arg[1]) {
+      case 's':
+        sizes.clear();
+        for (const string& s : items) {
+          Size size;
+          size_t x = s.find('x');
+          size.width = atoi(s.c_str());
+          size.height = x == string::npos ? size.width : atoi(s.c_str() + x + 1);
+          if (size.width && size.height) sizes.push_back(size);
+        }
+        break;
+      case 'r':
+        rates.clear();
+        for (const string& s : items) {
+          // the rasterizer needs a whole number of samples per pixel side
+          int rate = atoi(s.c_str());
+          if (rate != 1 && rate != 4 && rate != 9 && rate != 16) {
+            fprintf(stderr, "Sample rate must be 1, 4, 9 or 16.\n");
+            return 1;
+          }
+          rates.push_back(rate);
+        }
+        break;
+      case 'p':
+        psms.clear();
+        for (const string& s : items) {
+          int m = lookup(s, pixel_names, 2);
+          if (m >= 0) psms.push_back((PixelSampleMethod)m);
+        }
+        break;
+      case 'l':
+        lsms.clear();
+        for (const string& s : items) {
+          int m = lookup(s, level_names, 4);
+          if (m >= 0) lsms.push_back((LevelSampleMethod)m);
+        }
+        break;
+      case 'n':
+        iterations = max(1, atoi(value));
+        break;
+      case 'f':
+        options.format = image_format_for_path(string(".") + value);
+        break;
+      case 'c':
+        options.compression = max(-1, min(9, atoi(value)));
+        break;
+      case 'o':
+        output = value;
+        break;
+      default:
+        usage();
+        return 1;
+    }
+  }
+  if (sizes.empty() || rates.empty() || psms.empty() || lsms.empty()) {
+    usage();
+    return 1;
+  }
+
+  vector<string> files;
+  find_svgs(root, files);
+  if (files.empty()) {
+    fprintf(stderr, "No svg files found in %s\n", root.c_str());
+    return 1;
+  }
+
+  printf("{\n  \"iterations\": %d,\n  \"results\": [", iterations);
+  bool first = true;
+  for (const string& file : files) {
+    for (const Size& size : sizes) {
+      for (unsigned int rate : rates) {
+        for (PixelSampleMethod psm : psms) {
+          for (LevelSampleMethod lsm : lsms) {
+            vector<double> times[STAGES];
+            if (!run(file, size, rate, psm, lsm, iterations, output, options, times)) {
+              fprintf(stderr, "Could not load %s\n", file.c_str());
+              continue;
+            }
+            for (int s = 0; s < STAGES; ++s) sort(times[s].begin(), times[s].end());
+            fprintf(stderr, "%s %zux%zu rate %u %s %s: %.1f ms\n", file.c_str(),
+                    size.width, size.height, rate, pixel_names[psm], level_names[lsm],
+                    percentile(times[TOTAL], 50));
+
+            printf("%s\n    {\"file\": \"%s\", \"width\": %zu, \"height\": %zu, \"sample_rate\": %u, "
+                   "\"psm\": \"%s\", \"lsm\": \"%s\"", first ? "" : ",", file.c_str(),
+                   size.width, size.height, rate, pixel_names[psm], level_names[lsm]);
+            for (int s = 0; s < STAGES; ++s) {
+              printf(",\n     \"%s\": {\"median_ms\": %.4f, \"p95_ms\": %.4f}", stage_names[s],
+                     percentile(times[s], 50), percentile(times[s], 95));
+            }
+            printf("}");
+            first = false;
+          }
+        }
+      }
+    }
+  }
+  printf("\n  ]\n}\n");
+
+  remove(output.c_str());
+  return 0;
+}
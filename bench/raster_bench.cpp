@@ -0,0 +1,156 @@
+// Times the rasterizer kernels on synthetic workloads, without the SVG
+// parser or the display list in the way.
+//
+// Each workload is a fixed, seeded set of random primitives drawn straight
+// into a RasterizerImp in immediate mode, at each sample rate. The buffers
+// are cleared before every iteration, outside the timed part. The median
+// and the fastest iteration are printed, along with the median time per
+// primitive.
+//
+// Textured workloads map a 1024 x 1024 noise texture onto small triangles
+// so that each screen pixel spans the given number of texels, and sample
+// it trilinearly, or anisotropically where noted. Its mip levels are
+// generated before timing starts.
+//
+// usage: raster_bench [screen size] [iterations] [workload names...]
+
+#include "CGL/CGL.h"
+#include "CGL/timer.h"
+#include "rasterizer.h"
+#include "texture.h"
+#include "bench_workloads.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+using namespace CGL;
+
+enum Kind { TRIANGLES, SLIVERS, LINES, INTERPOLATED, TEXTURED };
+
+struct Workload {
+  const char* name;
+  Kind kind;
+  size_t count;
+  float size;           // extent of each primitive, as a fraction of the screen
+  float minification;   // texels per screen pixel, textured workloads only
+  LevelSampleMethod lsm;
+  unsigned int seed;
+};
+
+static const Workload workloads[] = {
+  { "tiny",         TRIANGLES,    50000, 0.005f, 0,  L_ZERO,        1 },
+  { "huge",         TRIANGLES,       16, 1.5f,   0,  L_ZERO,        2 },
+  { "slivers",      SLIVERS,      500,   0.8f,   0,  L_ZERO,        3 },
+  { "lines",        LINES,        2000,  1.0f,   0,  L_ZERO,        4 },
+  { "interpolated", INTERPOLATED, 2000,  0.1f,   0,  L_ZERO,        5 },
+  { "textured-1",   TEXTURED,     2000,  0.06f,  1,  L_LINEAR,      6 },
+  { "textured-4",   TEXTURED,     2000,  0.06f,  4,  L_LINEAR,      6 },
+  { "textured-16",  TEXTURED,     2000,  0.06f,  16, L_LINEAR,      6 },
+  { "textured-32",  TEXTURED,     2000,  0.06f,  32, L_LINEAR,      6 },
+  { "aniso-16",     TEXTURED,     2000,  0.06f,  16, L_ANISOTROPIC, 6 },
+};
+
+static const unsigned int rates[] = { 1, 4, 9, 16 };
+
+static const size_t kTextureSize = 1024;
+
+// A workload's primitives, as x y pairs for three vertices each, and
+// texture coordinates laid out the same way for textured workloads
+struct Primitives {
+  vector<float> points;
+  vector<float> uvs;
+};
+
+static Primitives make_primitives(const Workload& w, size_t screen) {
+  Primitives p;
+  if (w.kind == SLIVERS) {
+    p.points = random_slivers(w.count, screen, w.size, w.seed);
+  } else {
+    p.points = random_triangles(w.count, screen, w.size, w.seed);
+  }
+  if (w.kind == TEXTURED) {
+    p.uvs = random_uvs(p.points, screen, w.size, w.minification, kTextureSize, w.seed);
+  }
+  return p;
+}
+
+static void make_texture(Texture& tex) {
+  vector<unsigned char> pixels(3 * kTextureSize * kTextureSize);
+  BenchRandom rnd(7);
+  for (size_t i = 0; i < pixels.size(); ++i) pixels[i] = (unsigned char)(rnd.next_bits() >> 24);
+  tex.init(pixels, kTextureSize, kTextureSize);
+  tex.generate_mips();
+}
+
+static void draw(RasterizerImp& r, const Workload& w, const Primitives& prims, Texture& tex) {
+  Color color(0.2f, 0.4f, 0.8f);
+  Color c1(0.8f, 0.2f, 0.1f), c2(0.1f, 0.9f, 0.3f);
+  for (size_t i = 0; i < w.count; ++i) {
+    const float* p = &prims.points[6 * i];
+    switch (w.kind) {
+      case TRIANGLES:
+      case SLIVERS:
+        r.rasterize_triangle(p[0], p[1], p[2], p[3], p[4], p[5], color);
+        break;
+      case LINES:
+        r.rasterize_line(p[0], p[1], p[2], p[3], color);
+        break;
+      case INTERPOLATED:
+        r.rasterize_interpolated_color_triangle(p[0], p[1], color, p[2], p[3], c1, p[4], p[5], c2);
+        break;
+      case TEXTURED: {
+        const float* uv = &prims.uvs[6 * i];
+        r.rasterize_textured_triangle(p[0], p[1], uv[0], uv[1], p[2], p[3], uv[2], uv[3],
+                                      p[4], p[5], uv[4], uv[5], tex);
+        break;
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  size_t screen = argc > 1 ? atoi(argv[1]) : 512;
+  int iterations = argc > 2 ? max(1, atoi(argv[2])) : 5;
+  vector<const char*> only(argv + min(argc, 3), argv + argc);
+
+  vector<unsigned char> framebuffer(3 * screen * screen);
+  RasterizerImp r(P_LINEAR, L_ZERO, screen, screen, 1);
+  r.set_framebuffer_target(framebuffer.data(), screen, screen);
+
+  Texture tex;
+  make_texture(tex);
+
+  printf("%zux%zu screen, %d iterations\n", screen, screen, iterations);
+  printf("%-14s %5s %7s %12s %12s %12s\n", "workload", "rate", "prims", "median ms", "min ms", "ns/prim");
+
+  for (const Workload& w : workloads) {
+    if (!only.empty() && find_if(only.begin(), only.end(),
+                                 [&](const char* s) { return strcmp(s, w.name) == 0; }) == only.end())
+      continue;
+
+    Primitives prims = make_primitives(w, screen);
+    r.set_lsm(w.lsm);
+    for (unsigned int rate : rates) {
+      r.set_sample_rate(rate);
+      vector<double> times;
+      Timer timer;
+      for (int it = 0; it < iterations; ++it) {
+        r.clear_buffers();
+        timer.start();
+        draw(r, w, prims, tex);
+        timer.stop();
+        times.push_back(timer.duration() * 1000);
+      }
+      sort(times.begin(), times.end());
+      double median = times[times.size() / 2];
+      printf("%-14s %5u %7zu %12.3f %12.3f %12.1f\n", w.name, rate, w.count,
+             median, times[0], median * 1e6 / w.count);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,205 @@
+// Compares texture sampling throughput of the linear and tiled texel layouts.
+//
+// A screen-sized grid of samples is mapped onto a synthetic texture through a
+// rotation and a minification factor, the way a rotated textured quad would
+// be. Each configuration is sampled through Texture::sample for both layouts,
+// and through Texture::sample_quads in 2x2 quads on the linear layout. The
+// quad results are checked against Texture::sample given the same
+// derivatives, which must match exactly.
+//
+// usage: texture_bench [texture size] [screen size] [iterations]
+
+#include "CGL/CGL.h"
+#include "CGL/timer.h"
+#include "texture.h"
+#include "bench_workloads.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace CGL;
+
+struct Config {
+  const char* name;
+  PixelSampleMethod psm;
+  LevelSampleMethod lsm;
+  float degrees;
+  float minification;
+};
+
+static const Config configs[] = {
+  { "bilinear   0deg 1x",  P_LINEAR,  L_ZERO,    0, 1 },
+  { "bilinear  45deg 1x",  P_LINEAR,  L_ZERO,   45, 1 },
+  { "bilinear  90deg 1x",  P_LINEAR,  L_ZERO,   90, 1 },
+  { "nearest   90deg 1x",  P_NEAREST, L_ZERO,   90, 1 },
+  { "trilinear  0deg 3x",  P_LINEAR,  L_LINEAR,  0, 3 },
+  { "trilinear 30deg 3x",  P_LINEAR,  L_LINEAR, 30, 3 },
+  { "trilinear 90deg 3x",  P_LINEAR,  L_LINEAR, 90, 3 },
+};
+
+// Procedural texture with enough high frequency detail to be representative
+static vector<unsigned char> make_pixels(size_t size) {
+  vector<unsigned char> pixels(3 * size * size);
+  BenchRandom rnd;
+  for (size_t y = 0; y < size; ++y) {
+    for (size_t x = 0; x < size; ++x) {
+      unsigned char* p = &pixels[3 * (y * size + x)];
+      p[0] = (unsigned char)(x ^ y);
+      p[1] = (unsigned char)(x * 3 + y);
+      p[2] = (unsigned char)(rnd.next_bits() >> 24);
+    }
+  }
+  return pixels;
+}
+
+// Maps screen sample (x, y) onto the texture. The result is snapped to a grid
+// of 2^-20 so that sums and differences of neighbouring samples are exact,
+// which lets the quad path be checked against sample for identical results.
+static Vector2D screen_uv(const Vector2D& du, const Vector2D& dv, size_t screen, size_t x, size_t y) {
+  Vector2D uv = Vector2D(0.5, 0.5) + du * (x - screen / 2.0) + dv * (y - screen / 2.0);
+
+  // keep the footprint inside the texture
+  uv.x -= floor(uv.x); uv.y -= floor(uv.y);
+  if (uv.x > 0.99) uv.x = 0.99;
+  if (uv.y > 0.99) uv.y = 0.99;
+
+  const double grid = 1 << 20;
+  return Vector2D(floor(uv.x * grid) / grid, floor(uv.y * grid) / grid);
+}
+
+static void screen_axes(const Texture& tex, const Config& c, Vector2D& du, Vector2D& dv) {
+  float theta = radians(c.degrees);
+  float step = c.minification / tex.width;
+  du = Vector2D(cos(theta) * step, sin(theta) * step);
+  dv = Vector2D(-sin(theta) * step, cos(theta) * step);
+}
+
+// Returns nanoseconds per sample; accumulates colors into checksum
+static double run(Texture& tex, const Config& c, size_t screen, int iterations, float& checksum) {
+  Vector2D du, dv;
+  screen_axes(tex, c, du, dv);
+
+  SampleParams sp;
+  sp.psm = c.psm;
+  sp.lsm = c.lsm;
+
+  Timer timer;
+  timer.start();
+  for (int it = 0; it < iterations; ++it) {
+    for (size_t y = 0; y < screen; ++y) {
+      for (size_t x = 0; x < screen; ++x) {
+        Vector2D uv = screen_uv(du, dv, screen, x, y);
+        sp.p_uv = uv;
+        sp.p_dx_uv = uv + du;
+        sp.p_dy_uv = uv + dv;
+        Color col = tex.sample(sp);
+        checksum += col.r + col.g + col.b;
+      }
+    }
+  }
+  timer.stop();
+
+  return timer.duration() * 1e9 / ((double)screen * screen * iterations);
+}
+
+// Screen samples grouped into 2x2 quads in the order sample_quads expects:
+// top left, top right, bottom left, bottom right
+static vector<SampleQuad> make_quads(const Texture& tex, const Config& c, size_t screen) {
+  Vector2D du, dv;
+  screen_axes(tex, c, du, dv);
+
+  vector<SampleQuad> quads;
+  quads.reserve((screen / 2) * (screen / 2));
+  for (size_t y = 0; y + 1 < screen; y += 2) {
+    for (size_t x = 0; x + 1 < screen; x += 2) {
+      SampleQuad q;
+      for (int k = 0; k < 4; ++k) {
+        Vector2D uv = screen_uv(du, dv, screen, x + (k & 1), y + (k >> 1));
+        q.u[k] = uv.x;
+        q.v[k] = uv.y;
+      }
+      quads.push_back(q);
+    }
+  }
+  return quads;
+}
+
+// Returns nanoseconds per sample through sample_quads; the colors of the last
+// iteration are left in out
+static double run_quads(Texture& tex, const Config& c, const vector<SampleQuad>& quads,
+                        int iterations, vector<QuadColors>& out) {
+  out.resize(quads.size());
+
+  Timer timer;
+  timer.start();
+  for (int it = 0; it < iterations; ++it)
+    tex.sample_quads(quads.data(), quads.size(), out.data(), c.psm, c.lsm);
+  timer.stop();
+
+  return timer.duration() * 1e9 / (4.0 * quads.size() * iterations);
+}
+
+// Counts quad samples that differ from sample given the quad's derivatives
+static size_t check_quads(Texture& tex, const Config& c, const vector<SampleQuad>& quads,
+                          const vector<QuadColors>& out) {
+  SampleParams sp;
+  sp.psm = c.psm;
+  sp.lsm = c.lsm;
+  sp.max_aniso = kDefaultMaxAnisotropy;
+
+  size_t mismatches = 0;
+  for (size_t i = 0; i < quads.size(); ++i) {
+    const SampleQuad& q = quads[i];
+    Vector2D dx(q.u[1] - q.u[0], q.v[1] - q.v[0]);
+    Vector2D dy(q.u[2] - q.u[0], q.v[2] - q.v[0]);
+    for (int k = 0; k < 4; ++k) {
+      sp.p_uv = Vector2D(q.u[k], q.v[k]);
+      sp.p_dx_uv = sp.p_uv + dx;
+      sp.p_dy_uv = sp.p_uv + dy;
+      Color col = tex.sample(sp);
+      if (col.r != out[i].r[k] || col.g != out[i].g[k] || col.b != out[i].b[k])
+        ++mismatches;
+    }
+  }
+  return mismatches;
+}
+
+int main(int argc, char** argv) {
+  size_t size = argc > 1 ? atoi(argv[1]) : 2048;
+  size_t screen = argc > 2 ? atoi(argv[2]) : 512;
+  int iterations = argc > 3 ? atoi(argv[3]) : 3;
+
+  vector<unsigned char> pixels = make_pixels(size);
+
+  Texture linear, tiled;
+  linear.init(pixels, size, size, TEXELS_LINEAR);
+  tiled.init(pixels, size, size, TEXELS_TILED);
+
+  // build the mips up front so only sampling is timed
+  linear.generate_mips();
+  tiled.generate_mips();
+
+  printf("texture %zux%zu, %zux%zu samples, %d iterations\n", size, size, screen, screen, iterations);
+  printf("%-20s %14s %14s %8s %14s\n", "config", "linear ns/smp", "tiled ns/smp", "speedup", "quads ns/smp");
+
+  for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); ++i) {
+    float sum_linear = 0, sum_tiled = 0;
+    double t_linear = run(linear, configs[i], screen, iterations, sum_linear);
+    double t_tiled = run(tiled, configs[i], screen, iterations, sum_tiled);
+
+    vector<SampleQuad> quads = make_quads(linear, configs[i], screen);
+    vector<QuadColors> quad_colors;
+    double t_quads = run_quads(linear, configs[i], quads, iterations, quad_colors);
+    size_t mismatches = check_quads(linear, configs[i], quads, quad_colors);
+
+    printf("%-20s %14.2f %14.2f %7.2fx %14.2f", configs[i].name, t_linear, t_tiled, t_linear / t_tiled, t_quads);
+    if (sum_linear != sum_tiled) printf("  (results differ!)");
+    if (mismatches) printf("  (%zu quad samples differ!)", mismatches);
+    printf("\n");
+  }
+
+  return 0;
+}
@@ -7,12 +7,30 @@
 #include "CGL/lodepng.h"
 #include "texture.h"
 #include <ctime>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
 #include "rasterizer.h"
 
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
 namespace CGL {
 
+// How long input must pause before a preview is refined
+static const chrono::milliseconds REFINE_DELAY(150);
+
+// Size in pixels of the region the zoom window magnifies, and the most it
+// is magnified by
+static const size_t ZOOM_REGION = 32;
+static const size_t ZOOM_FACTOR = 16;
+
+// Size of the sample buffer write_banded aims for
+static const size_t BAND_BYTES = 64 << 20;
+
 struct SVG;
 
 
@@ -23,6 +41,15 @@ DrawRend::DrawRend(std::vector<SVG*> svgs_)
 
 
 DrawRend::~DrawRend(void) {
+  if (render_thread.joinable()) {
+    {
+      lock_guard<mutex> lock(state_mutex);
+      quit = true;
+      cancel = true;
+    }
+    frame_requested.notify_one();
+    render_thread.join();
+  }
   svgs.clear();
   delete software_rasterizer;
 }
@@ -36,6 +63,8 @@ void DrawRend::init() {
 
   sample_rate = 1;
   left_clicked = false;
+  pan_x = pan_y = 0;
+  panned = false;
   show_zoom = 0;
 
   svg_to_ndc.resize(svgs.size());
@@ -46,15 +75,30 @@ void DrawRend::init() {
   current_svg = 0;
   psm = P_NEAREST;
   lsm = L_ZERO;
+  max_aniso = kDefaultMaxAnisotropy;
+  stroke_mode = S_HAIRLINE;
+  occlusion_culling = false;
+  progressive = true;
   
   width = height = 0;
 
+  pending = pending_full = refining = quit = false;
+  pending_dx = pending_dy = 0;
+  cancel = false;
+  display_width = display_height = 0;
+  frame_valid = false;
+
   software_rasterizer = new RasterizerImp(psm, lsm, width, height, sample_rate);
+  software_rasterizer->set_retained(true);
+  software_rasterizer->set_cancel_flag(&cancel);
+
+  // the SVGs were loaded on this thread
+  frame_stats = render_stats();
 }
 
 /**
 * Draw content.
-* Simply reposts the framebuffer and the zoom window, if applicable.
+* Simply reposts the last finished frame and the zoom window, if applicable.
 */
 void DrawRend::render() {
   draw_pixels();
@@ -70,32 +114,42 @@ void DrawRend::render() {
  * \param h The new height of the context
  */
 void DrawRend::resize(size_t w, size_t h) {
-  width = w; height = h;
+  set_screen_size(w, h);
+  redraw();
+}
 
-  framebuffer.resize(3 * w * h);
+void DrawRend::set_screen_size(size_t w, size_t h) {
+  width = w; height = h;
 
   float scale = min(width, height);
   ndc_to_screen(0, 0) = scale; ndc_to_screen(0, 2) = (width - scale) / 2;
   ndc_to_screen(1, 1) = scale; ndc_to_screen(1, 2) = (height - scale) / 2;
-  
-  software_rasterizer->set_framebuffer_target(framebuffer.data(), width, height);
-
-  redraw();
 }
 
 /**
  * Return a brief description of the renderer.
  * Displays current buffer resolution, sampling method, sampling rate.
  */
-static const string level_strings[] = { "level zero", "nearest level", "bilinear level interpolation" };
+static const string level_strings[] = { "level zero", "nearest level", "bilinear level interpolation", "anisotropic" };
 static const string pixel_strings[] = { "nearest pixel", "bilinear pixel interpolation" };
+static const string stroke_strings[] = { "hairlines", "antialiased hairlines", "tessellated triangles" };
 std::string DrawRend::info() {
   stringstream ss;
   stringstream sample_method;
-  sample_method << level_strings[lsm] << ", " << pixel_strings[psm];
+  sample_method << level_strings[lsm];
+  if (lsm == L_ANISOTROPIC) sample_method << " (up to " << max_aniso << "x)";
+  sample_method << ", " << pixel_strings[psm];
   ss << "Resolution " << width << " x " << height << ". ";
   ss << "Using " << sample_method.str() << " sampling. ";
   ss << "Supersample rate " << sample_rate << " per pixel. ";
+  ss << "Strokes drawn as " << stroke_strings[stroke_mode] << ". ";
+  if (occlusion_culling) ss << "Occlusion culling on. ";
+  if (progressive && sample_rate > 1) ss << "Progressive refinement on. ";
+#ifdef DRAW_STATS
+  // the viewer shows each line on a line of its own
+  lock_guard<mutex> lock(state_mutex);
+  ss << "\nLast frame: " << frame_stats.summary();
+#endif
   return ss.str();
 }
 
@@ -113,8 +167,17 @@ void DrawRend::cursor_event(float x, float y) {
   if (left_clicked) {
     float dx = (x - cursor_x) / width * svgs[current_svg]->width;
     float dy = (y - cursor_y) / height * svgs[current_svg]->height;
-    move_view(dx, dy, 1);
-    redraw();
+
+    // the view moves by whole pixels, carrying the rest over to the next
+    // event, so that the previous frame can be shifted and reused
+    double pixels_per_unit = ndc_to_screen(0, 0) / svg_to_ndc[current_svg](2, 2);
+    pan_x += dx * pixels_per_unit;
+    pan_y += dy * pixels_per_unit;
+    int px = (int)round(pan_x), py = (int)round(pan_y);
+    if (px || py) {
+      pan_x -= px; pan_y -= py;
+      pan(px, py);
+    }
   }
 
   // register new cursor location
@@ -152,10 +215,16 @@ void DrawRend::scroll_event(float offset_x, float offset_y) {
  */
 void DrawRend::mouse_event(int key, int event, unsigned char mods) {
   if (key == MOUSE_LEFT) {
-    if (event == EVENT_PRESS)
+    if (event == EVENT_PRESS) {
       left_clicked = true;
-    if (event == EVENT_RELEASE)
+      pan_x = pan_y = 0;
+    }
+    if (event == EVENT_RELEASE) {
       left_clicked = false;
+      // the shifted pixels were rasterized at the previous offsets,
+      // settle on an exact frame
+      if (panned) redraw();
+    }
   }
 }
 
@@ -193,14 +262,12 @@ void DrawRend::keyboard_event(int key, int event, unsigned char mods) {
   case '=':
     if (sample_rate < 16) {
       sample_rate = (int)(sqrt(sample_rate) + 1) * (sqrt(sample_rate) + 1);
-      software_rasterizer->set_sample_rate(sample_rate);
       redraw();
     }
     break;
   case '-':
     if (sample_rate > 1) {
       sample_rate = (int)(sqrt(sample_rate) - 1) * (sqrt(sample_rate) - 1);
-      software_rasterizer->set_sample_rate(sample_rate);
       redraw();
     }
     break;
@@ -213,13 +280,34 @@ void DrawRend::keyboard_event(int key, int event, unsigned char mods) {
     // toggle pixel sampling scheme
   case 'P':
     psm = (PixelSampleMethod)((psm + 1) % 2);
-    software_rasterizer->set_psm(psm);
     redraw();
     break;
     // toggle level sampling scheme
   case 'L':
-    lsm = (LevelSampleMethod)((lsm + 1) % 3);
-    software_rasterizer->set_lsm(lsm);
+    lsm = (LevelSampleMethod)((lsm + 1) % 4);
+    redraw();
+    break;
+    // cycle the anisotropic filtering ratio through 2, 4, 8 and 16
+  case 'A':
+    max_aniso = max_aniso >= 16 ? 2 : max_aniso * 2;
+    if (lsm == L_ANISOTROPIC) redraw();
+    break;
+
+    // cycle through hairline, antialiased hairline and tessellated strokes
+  case 'W':
+    stroke_mode = (StrokeMode)((stroke_mode + 1) % 3);
+    redraw();
+    break;
+
+    // toggle skipping primitives hidden behind later opaque ones
+  case 'O':
+    occlusion_culling = !occlusion_culling;
+    redraw();
+    break;
+
+    // toggle drawing a 1 sample per pixel preview while the view changes
+  case 'R':
+    progressive = !progressive;
     redraw();
     break;
 
@@ -233,26 +321,71 @@ void DrawRend::keyboard_event(int key, int event, unsigned char mods) {
   }
 }
 
+// Sets n pixels to v
+static inline void fill_pixels(uint32_t* p, uint32_t v, size_t n) {
+  size_t i = 0;
+#ifdef __AVX__
+  __m256i v8 = _mm256_set1_epi32(v);
+  for (; i + 8 <= n; i += 8) _mm256_storeu_si256((__m256i*)(p + i), v8);
+#endif
+  for (; i < n; ++i) p[i] = v;
+}
+
+// Magnifies the size x size pixels at (x0, y0) of the RGB image src, w
+// pixels wide, by factor into RGBA rows of dst, stride pixels apart. The
+// first row and column of each magnified pixel are lightened to show the
+// pixel grid. Each source row gives two distinct output rows, which are
+// built once and copied.
+static void zoom_blit(const unsigned char* src, size_t w,
+                      size_t x0, size_t y0, size_t size, size_t factor,
+                      unsigned char* dst, size_t stride) {
+  const float s = .3;
+  size_t n = size * factor;
+  vector<uint32_t> grid(n), inner(n);
+  for (size_t y = 0; y < size; ++y) {
+    const unsigned char* p = src + 3 * ((y0 + y) * w + x0);
+    for (size_t x = 0; x < size; ++x, p += 3) {
+      unsigned char c[4] = { p[0], p[1], p[2], 255 }, l[4];
+      for (int k = 0; k < 3; ++k) l[k] = (int)((1. - 2. * s) * c[k] + s * 255.);
+      l[3] = 255;
+      uint32_t cv, lv;
+      memcpy(&cv, c, 4);
+      memcpy(&lv, l, 4);
+      fill_pixels(&grid[x * factor], lv, factor);
+      inner[x * factor] = lv;
+      fill_pixels(&inner[x * factor + 1], cv, factor - 1);
+    }
+    unsigned char* row = dst + 4 * y * factor * stride;
+    memcpy(row, grid.data(), 4 * n);
+    for (size_t j = 1; j < factor; ++j)
+      memcpy(row + 4 * j * stride, inner.data(), 4 * n);
+  }
+}
+
 /**
  * Writes the contents of the pixel buffer to disk as a .png file.
  * The image filename contains the month, date, hour, minute, and second
  * to make sure it is unique and identifiable.
  */
 void DrawRend::write_screenshot() {
-  redraw();
-  if (show_zoom) draw_zoom();
-
-  vector<unsigned char> windowPixels(4 * width * height);
-  glReadPixels(0, 0,
-    width,
-    height,
-    GL_RGBA,
-    GL_UNSIGNED_BYTE,
-    &windowPixels[0]);
+  vector<unsigned char> pixels;
+  size_t w, h;
+  {
+    lock_guard<mutex> lock(state_mutex);
+    w = display_width; h = display_height;
+    if (display.empty()) {
+      cerr << "No frame to write" << endl;
+      return;
+    }
+    pixels.resize(4 * w * h);
+    rgb_to_rgba(display.data(), pixels.data(), w * h);
 
-  vector<unsigned char> flippedPixels(4 * width * height);
-  for (int row = 0; row < height; ++row)
-    memcpy(&flippedPixels[row * width * 4], &windowPixels[(height - row - 1) * width * 4], 4 * width);
+    size_t x0, y0, size, zoom_size;
+    if (show_zoom && zoom_region(x0, y0, size, zoom_size)) {
+      zoom_blit(display.data(), w, x0, y0, size, zoom_size / size,
+                &pixels[4 * (w - zoom_size)], w);
+    }
+  }
 
   time_t t = time(nullptr);
   tm* lt = localtime(&t);
@@ -261,34 +394,65 @@ void DrawRend::write_screenshot() {
     << lt->tm_hour << "-" << lt->tm_min << "-" << lt->tm_sec << ".png";
   string file = ss.str();
   cout << "Writing file " << file << "...";
-  if (lodepng::encode(file, flippedPixels, width, height))
+  if (lodepng::encode(file, pixels, w, h))
     cerr << "Could not be written" << endl;
   else
     cout << "Success!" << endl;
 }
 
 /**
- * Writes the contents of the framebuffer to disk as a .png file.
- *
+ * Writes the contents of the framebuffer to disk, in the format and with
+ * the compression given by options.
  */
-void DrawRend::write_framebuffer() {
-  // lodepng expects alpha channel, so we will just make a new vector with
-  // alpha included
-
-  std::vector<unsigned char> export_data;
+void DrawRend::write_framebuffer(const string& path, const ImageWriteOptions& options) {
+  if (write_image(path, framebuffer.data(), width, height, options))
+    cerr << "Could not write framebuffer" << endl;
+  else
+    cerr << "Succesfully wrote framebuffer" << endl;
+}
 
-  export_data.reserve(width * height * 4);
+/**
+ * Draws the current view at w x h and writes it to disk one band of rows
+ * at a time, so that neither the framebuffer nor the sample buffer of the
+ * whole image is ever held. The scene is recorded once, with the first
+ * band; the other bands are drawn from the display list, each from only
+ * the primitives overlapping it.
+ */
+void DrawRend::write_banded(const string& path, size_t w, size_t h,
+                            const ImageWriteOptions& options, size_t band_rows) {
+  lock_guard<mutex> raster(raster_mutex);
+  set_screen_size(w, h);
+  FrameRequest f = current_frame();
+  if (!band_rows)
+    band_rows = max((size_t)1, BAND_BYTES / (w * f.sample_rate * sizeof(Color)));
+  band_rows = min(band_rows, h);
+
+  ImageRowWriter writer;
+  if (writer.open(path, w, h, options)) {
+    cerr << "Could not write framebuffer" << endl;
+    return;
+  }
 
-  for (int y = 0; y < height; ++y) {
-    for (int x = 0; x < width; ++x) {
-      for (int k = 0; k < 3; ++k) {
-        export_data.push_back(framebuffer[3 * (y * width + x) + k]);
-      }
-      export_data.push_back(255); // Opaque alpha
-    }
+  vector<unsigned char> band(3 * w * band_rows);
+  software_rasterizer->set_band_target(band.data(), w, h, 0, band_rows);
+  configure_rasterizer(f);
+  software_rasterizer->clear_buffers();
+  render_stats().clear();
+  draw_scene(f);
+  writer.write_rows(band.data(), band_rows);
+
+  for (size_t y0 = band_rows; y0 < h; y0 += band_rows) {
+    size_t y1 = min(h, y0 + band_rows);
+    software_rasterizer->set_band_target(band.data(), w, h, y0, y1);
+    software_rasterizer->resolve_to_framebuffer();
+    writer.write_rows(band.data(), y1 - y0);
   }
+  snapshot_stats();
 
-  if (lodepng::encode("test.png", export_data.data(), width, height))
+  // the rasterizer no longer holds a frame that can be reused
+  frame_valid = false;
+
+  if (writer.close())
     cerr << "Could not write framebuffer" << endl;
   else
     cerr << "Succesfully wrote framebuffer" << endl;
@@ -301,130 +465,288 @@ void DrawRend::write_framebuffer() {
  * into the framebuffer before posting the framebuffer pixels to the screen.
  */
 void DrawRend::redraw() {
-  software_rasterizer->clear_buffers();
+  panned = false;
+  request_frame(true);
+}
 
-  SVG& svg = *svgs[current_svg];
-  svg.draw(software_rasterizer, ndc_to_screen * svg_to_ndc[current_svg]);
+/**
+ * Pans the view by (dx, dy) screen pixels. The previous frame is shifted
+ * along, and only the strips it no longer covers are rasterized.
+ */
+void DrawRend::pan(int dx, int dy) {
+  double pixels_per_unit = ndc_to_screen(0, 0) / svg_to_ndc[current_svg](2, 2);
+  move_view(dx / pixels_per_unit, dy / pixels_per_unit, 1);
+  panned = true;
+  request_frame(false, dx, dy);
+}
 
-  // draw canvas outline
-  Vector2D a = ndc_to_screen * svg_to_ndc[current_svg] * (Vector2D(0, 0)); a.x--; a.y++;
-  Vector2D b = ndc_to_screen * svg_to_ndc[current_svg] * (Vector2D(svg.width, 0)); b.x++; b.y++;
-  Vector2D c = ndc_to_screen * svg_to_ndc[current_svg] * (Vector2D(0, svg.height)); c.x--; c.y--;
-  Vector2D d = ndc_to_screen * svg_to_ndc[current_svg] * (Vector2D(svg.width, svg.height)); d.x++; d.y--;
+/**
+ * Snapshots the current view and settings.
+ */
+DrawRend::FrameRequest DrawRend::current_frame() const {
+  FrameRequest f;
+  f.svg = current_svg;
+  f.svg_to_screen = ndc_to_screen * svg_to_ndc[current_svg];
+  f.width = width; f.height = height;
+  f.sample_rate = sample_rate;
+  f.psm = psm; f.lsm = lsm;
+  f.max_aniso = max_aniso;
+  f.stroke_mode = stroke_mode;
+  f.occlusion_culling = occlusion_culling;
+  f.progressive = progressive;
+  return f;
+}
 
-  software_rasterizer->rasterize_line(a.x, a.y, b.x, b.y, Color::Black);
-  software_rasterizer->rasterize_line(a.x, a.y, c.x, c.y, Color::Black);
-  software_rasterizer->rasterize_line(d.x, d.y, b.x, b.y, Color::Black);
-  software_rasterizer->rasterize_line(d.x, d.y, c.x, c.y, Color::Black);
+/**
+ * Without gl the frame is drawn right away. Otherwise it is left for the
+ * render thread, replacing a request it has not started on yet. Pans
+ * accumulate, so that they can still be drawn by shifting the frame before
+ * them; a full redraw cancels the frame being drawn, which is out of date,
+ * and so does any request while a preview is being refined.
+ */
+void DrawRend::request_frame(bool full, int dx, int dy) {
+  if (!gl) {
+    lock_guard<mutex> raster(raster_mutex);
+    draw_frame(current_frame(), dx, dy, full);
+    return;
+  }
 
-  software_rasterizer->resolve_to_framebuffer();
-  if (gl)
-    draw_pixels();
+  lock_guard<mutex> lock(state_mutex);
+  request = current_frame();
+  if (full || refining) {
+    pending_full = true;
+    cancel = true;
+  } else {
+    pending_dx += dx;
+    pending_dy += dy;
+  }
+  pending = true;
+  if (!render_thread.joinable())
+    render_thread = thread(&DrawRend::render_loop, this);
+  frame_requested.notify_one();
 }
 
 /**
- * OpenGL boilerplate to put an array of RGBA pixels on the screen.
+ * Body of the render thread: draws the latest request until told to quit.
+ * In progressive mode a full redraw is drawn at 1 sample per pixel, and a
+ * pan at the rate of the frame it shifts. If no other request comes in for
+ * REFINE_DELAY, the frame is then drawn again at the full sample rate.
+ * Supersamples lie on a different grid at each rate, so the preview
+ * samples cannot be kept; the refined frame is the same as a frame drawn
+ * at that rate directly.
  */
-void DrawRend::draw_pixels() {
-  const unsigned char* pixels = &framebuffer[0];
-  // copy pixels to the screen
-  glPushAttrib(GL_VIEWPORT_BIT);
-  glViewport(0, 0, width, height);
+void DrawRend::render_loop() {
+  unique_lock<mutex> lock(state_mutex);
+  while (true) {
+    frame_requested.wait(lock, [this] { return pending || quit; });
+    if (quit) return;
+
+    FrameRequest f = request;
+    bool full = pending_full;
+    int dx = pending_dx, dy = pending_dy;
+    pending = pending_full = false;
+    pending_dx = pending_dy = 0;
+    cancel = false;
+    lock.unlock();
+
+    FrameRequest first = f;
+    {
+      lock_guard<mutex> raster(raster_mutex);
+      if (f.progressive && f.sample_rate > 1)
+        first.sample_rate = full || !frame_valid ? 1 : drawn.sample_rate;
+      if (draw_frame(first, dx, dy, full)) publish();
+    }
 
-  glMatrixMode(GL_PROJECTION);
-  glPushMatrix();
-  glLoadIdentity();
-  glOrtho(0, width, 0, height, 0, 0);
+    lock.lock();
+    if (first.sample_rate == f.sample_rate) continue;
+    if (frame_requested.wait_for(lock, REFINE_DELAY, [this] { return pending || quit; }))
+      continue;
 
-  glMatrixMode(GL_MODELVIEW);
-  glPushMatrix();
-  glLoadIdentity();
-  glTranslatef(-1, 1, 0);
+    refining = true;
+    lock.unlock();
+    {
+      lock_guard<mutex> raster(raster_mutex);
+      if (draw_frame(f, 0, 0, true)) publish();
+    }
+    lock.lock();
+    refining = false;
+  }
+}
 
-  glRasterPos2f(0, 0);
-  glPixelZoom(1.0, -1.0);
-  glDrawPixels(width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
-  glPixelZoom(1.0, 1.0);
+/**
+ * Draws the frame f into framebuffer. Unless full is set, the previous
+ * frame is taken to be f panned by (-dx, -dy) pixels, and is reused.
+ */
+bool DrawRend::draw_frame(const FrameRequest& f, int dx, int dy, bool full) {
+  if (!full && frame_valid && !dx && !dy) return true;
+
+  framebuffer.resize(3 * f.width * f.height);
+  software_rasterizer->set_framebuffer_target(framebuffer.data(), f.width, f.height);
+  configure_rasterizer(f);
+
+  if (full || !frame_valid || !software_rasterizer->scroll(dx, dy))
+    software_rasterizer->clear_buffers();
+  render_stats().clear();
+  draw_scene(f);
+  snapshot_stats();
+
+  drawn = f;
+  frame_valid = !software_rasterizer->cancelled();
+  return frame_valid;
+}
 
-  glPopAttrib();
-  glMatrixMode(GL_PROJECTION); glPopMatrix();
-  glMatrixMode(GL_MODELVIEW); glPopMatrix();
+void DrawRend::configure_rasterizer(const FrameRequest& f) {
+  software_rasterizer->set_sample_rate(f.sample_rate);
+  software_rasterizer->set_psm(f.psm);
+  software_rasterizer->set_lsm(f.lsm);
+  software_rasterizer->set_max_anisotropy(f.max_aniso);
+  software_rasterizer->set_stroke_mode(f.stroke_mode);
+  software_rasterizer->set_occlusion_culling(f.occlusion_culling);
 }
 
 /**
- * Reads off the pixels that should be in the zoom window, and
- * generates a pixel array with the zoomed view.
+ * Hands the frame in framebuffer over to render(), unless a newer one was
+ * asked for while it was drawn.
  */
-void DrawRend::draw_zoom() {
+void DrawRend::publish() {
+  lock_guard<mutex> lock(state_mutex);
+  if (pending) return;
+  unsigned char* pixels = stream.acquire(drawn.width, drawn.height);
+  rgb_to_rgba(framebuffer.data(), pixels, drawn.width * drawn.height);
+  stream.submit();
+
+  display = framebuffer;
+  display_width = drawn.width;
+  display_height = drawn.height;
+}
 
-  // size (in pixels) of region of interest
-  size_t regionSize = 32;
+/**
+ * Keeps the stats of the frame just drawn on this thread for info() and
+ * write_stats. The parse time is the one found by init.
+ */
+void DrawRend::snapshot_stats() {
+  lock_guard<mutex> lock(state_mutex);
+  double parse = frame_stats.seconds[RenderStats::PARSE];
+  frame_stats = render_stats();
+  frame_stats.seconds[RenderStats::PARSE] = parse;
+}
 
-  // relative size of zoom window
-  size_t zoomFactor = 16;
+/**
+ * Writes the stats of the last frame to disk as JSON. Without DRAW_STATS
+ * nothing is counted, and nothing is written.
+ */
+void DrawRend::write_stats(const string& path) {
+#ifdef DRAW_STATS
+  lock_guard<mutex> lock(state_mutex);
+  ofstream out(path.c_str());
+  out << frame_stats.json();
+  if (!out)
+    cerr << "Could not write stats" << endl;
+#endif
+}
 
-  // compute zoom factor---the zoom window should never cover
-  // more than 40% of the framebuffer, horizontally or vertically
-  size_t bufferSize = min(width, height);
-  if (regionSize * zoomFactor > bufferSize * 0.4) {
-    zoomFactor = (bufferSize * 0.4) / regionSize;
-  }
-  size_t zoomSize = regionSize * zoomFactor;
-
-  // adjust the cursor coordinates so that the region of
-  // interest never goes outside the bounds of the framebuffer
-  size_t cX = max(regionSize / 2, min(width - regionSize / 2 - 1, (size_t)cursor_x));
-  size_t cY = max(regionSize / 2, min(height - regionSize / 2 - 1, height - (size_t)cursor_y));
-
-  // grab pixels from the region of interest
-  vector<unsigned char> windowPixels(3 * regionSize * regionSize);
-  glReadPixels(cX - regionSize / 2,
-    cY - regionSize / 2 + 1, // meh
-    regionSize,
-    regionSize,
-    GL_RGB,
-    GL_UNSIGNED_BYTE,
-    &windowPixels[0]);
-
-  // upsample by the zoom factor, highlighting pixel boundaries
-  vector<unsigned char> zoomPixels(3 * zoomSize * zoomSize);
-  unsigned char* wp = &windowPixels[0];
-  // outer loop over pixels in region of interest
-  for (int y = 0; y < regionSize; y++) {
-    int y0 = y * zoomFactor;
-    for (int x = 0; x < regionSize; x++) {
-      int x0 = x * zoomFactor;
-      unsigned char* zp = &zoomPixels[(x0 + y0 * zoomSize) * 3];
-      // inner loop over upsampled block
-      for (int j = 0; j < zoomFactor; j++) {
-        for (int i = 0; i < zoomFactor; i++) {
-          for (int k = 0; k < 3; k++) {
-            // highlight pixel boundaries
-            if (i == 0 || j == 0) {
-              const float s = .3;
-              zp[k] = (int)((1. - 2. * s) * wp[k] + s * 255.);
-            }
-            else {
-              zp[k] = wp[k];
-            }
-          }
-          zp += 3;
-        }
-        zp += 3 * (zoomSize - zoomFactor);
-      }
-      wp += 3;
-    }
-  }
+/**
+ * Rasterizes the SVG tab of f and its canvas outline, and resolves the
+ * result to the framebuffer.
+ */
+void DrawRend::draw_scene(const FrameRequest& f) {
+  SVG& svg = *svgs[f.svg];
+  const Matrix3x3& m = f.svg_to_screen;
+  svg.draw(software_rasterizer, m);
+
+  // draw canvas outline, tagged after the last element
+  software_rasterizer->set_tag(svg.elements.size());
+  Vector2D a = m * (Vector2D(0, 0)); a.x--; a.y++;
+  Vector2D b = m * (Vector2D(svg.width, 0)); b.x++; b.y++;
+  Vector2D c = m * (Vector2D(0, svg.height)); c.x--; c.y--;
+  Vector2D d = m * (Vector2D(svg.width, svg.height)); d.x++; d.y--;
 
-  // copy pixels to the screen using OpenGL
-  glMatrixMode(GL_PROJECTION); glPushMatrix(); glLoadIdentity(); glOrtho(0, width, 0, height, 0.01, 1000.);
-  glMatrixMode(GL_MODELVIEW); glPushMatrix(); glLoadIdentity(); glTranslated(0., 0., -1.);
+  software_rasterizer->rasterize_line(a.x, a.y, b.x, b.y, Color::Black);
+  software_rasterizer->rasterize_line(a.x, a.y, c.x, c.y, Color::Black);
+  software_rasterizer->rasterize_line(d.x, d.y, b.x, b.y, Color::Black);
+  software_rasterizer->rasterize_line(d.x, d.y, c.x, c.y, Color::Black);
 
-  glRasterPos2i(width - zoomSize, height - zoomSize);
-  glDrawPixels(zoomSize, zoomSize, GL_RGB, GL_UNSIGNED_BYTE, &zoomPixels[0]);
-  glMatrixMode(GL_PROJECTION); glPopMatrix();
-  glMatrixMode(GL_MODELVIEW); glPopMatrix();
+  software_rasterizer->resolve_to_framebuffer();
+}
+
+/**
+ * Draws the pixels in rect again, re-rasterizing only the primitives of the
+ * last frame that overlap it. Nothing is done if that frame was cancelled,
+ * as the frame replacing it is drawn in full.
+ */
+void DrawRend::redraw_region(const IntRect& rect) {
+  lock_guard<mutex> raster(raster_mutex);
+  if (!frame_valid) return;
+  software_rasterizer->redraw_region(rect);
+  frame_valid = !software_rasterizer->cancelled();
+  if (frame_valid && gl) publish();
+}
+
+/**
+ * Updates the display list after element i of the SVG of the last frame has
+ * changed and redraws the pixels it covers, before and after the change.
+ */
+void DrawRend::redraw_element(size_t i) {
+  lock_guard<mutex> raster(raster_mutex);
+  if (!frame_valid) return;
+  SVG& svg = *svgs[drawn.svg];
+  if (i >= svg.elements.size()) return;
+
+  software_rasterizer->begin_update(i);
+  svg.elements[i]->draw(software_rasterizer, drawn.svg_to_screen);
+  IntRect dirty;
+  if (!software_rasterizer->end_update(dirty)) return;
+
+  software_rasterizer->redraw_region(dirty);
+  frame_valid = !software_rasterizer->cancelled();
+  if (frame_valid && gl) publish();
+}
+
+/**
+ * Puts the last finished frame on the screen, uploading it first if it is
+ * new.
+ */
+void DrawRend::draw_pixels() {
+  {
+    lock_guard<mutex> lock(state_mutex);
+    stream.update();
+  }
+  stream.draw();
+}
+
+/**
+ * Draws the zoom window in the top right corner, magnifying the pixels of
+ * the frame on screen around the cursor.
+ */
+void DrawRend::draw_zoom() {
+  size_t x0, y0, size, zoom_size, w, h;
+  {
+    lock_guard<mutex> lock(state_mutex);
+    if (!zoom_region(x0, y0, size, zoom_size)) return;
+    w = display_width; h = display_height;
+    unsigned char* pixels = zoom_stream.acquire(zoom_size, zoom_size);
+    zoom_blit(display.data(), w, x0, y0, size, zoom_size / size, pixels, zoom_size);
+    zoom_stream.submit();
+  }
+  zoom_stream.update();
+  zoom_stream.draw(w - zoom_size, h - zoom_size);
+}
 
+bool DrawRend::zoom_region(size_t& x0, size_t& y0, size_t& size, size_t& zoom_size) {
+  size_t w = display_width, h = display_height;
+  size = ZOOM_REGION;
+  if (w < size || h < size) return false;
+
+  // the zoom window should never cover more than 40% of the frame,
+  // horizontally or vertically
+  size_t factor = min(ZOOM_FACTOR, (size_t)(min(w, h) * 0.4 / size));
+  if (!factor) return false;
+  zoom_size = size * factor;
+
+  // keep the region inside the frame
+  x0 = (size_t)max(0.f, min((float)(w - size), cursor_x - size / 2));
+  y0 = (size_t)max(0.f, min((float)(h - size), cursor_y - size / 2));
+  return true;
 }
 
 /**
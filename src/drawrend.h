@@ -6,6 +6,13 @@
 #include "CGL/color.h"
 #include <vector>
 #include <cstring>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "frame_stream.h"
+#include "image_writer.h"
+#include "render_stats.h"
 #include "GLFW/glfw3.h"
 #include "svg.h"
 
@@ -31,15 +38,38 @@ class DrawRend : public Renderer {
   void keyboard_event( int key, int event, unsigned char mods );
 
   void set_gl(bool gl_) { gl = gl_; }
+  void set_sample_rate(int rate) { sample_rate = rate; }
 
   // write current pixel buffer to disk
   void write_screenshot();
 
   // write only framebuffer to disk
-  void write_framebuffer();
-
-  // drawing functions
+  void write_framebuffer(const std::string& path = "test.png",
+                         const ImageWriteOptions& options = ImageWriteOptions());
+
+  // draw the current view at w x h to disk a band of rows at a time,
+  // without holding the whole frame. band_rows defaults to what keeps
+  // the sample buffer near BAND_BYTES.
+  void write_banded(const std::string& path, size_t w, size_t h,
+                    const ImageWriteOptions& options = ImageWriteOptions(),
+                    size_t band_rows = 0);
+
+  // write the stats of the last frame to disk as JSON, in builds that
+  // keep them
+  void write_stats(const std::string& path);
+
+  // drawing functions. With gl on, frames are drawn on a background
+  // thread and these only ask for one; otherwise they draw before returning.
   void redraw();
+
+  // Incremental redraws from the display list of the last redraw: the
+  // pixels in rect, or the pixels touched by element i of the current SVG
+  // before and after it was changed
+  void redraw_region(const IntRect& rect);
+  void redraw_element(size_t i);
+
+  // Pans the view by whole screen pixels, reusing the previous frame
+  void pan(int dx, int dy);
   void draw_pixels();
   void draw_zoom();
 
@@ -64,13 +94,100 @@ private:
   // UI state info
   float cursor_x; float cursor_y;
   bool left_clicked;
+  // pan not yet applied, in screen pixels, and whether the frame on
+  // screen was panned since it was last drawn in full
+  double pan_x, pan_y;
+  bool panned;
   int show_zoom;
   int sample_rate;
 
   PixelSampleMethod psm;
   LevelSampleMethod lsm;
+  unsigned int max_aniso;
+  StrokeMode stroke_mode;
+  bool occlusion_culling;
+
+  // In progressive mode a changed view is first drawn at 1 sample per
+  // pixel, and at the full sample rate once input has settled
+  bool progressive;
 
   bool gl;
+
+  // The view and settings a frame is drawn with
+  struct FrameRequest {
+    size_t svg;
+    Matrix3x3 svg_to_screen;
+    size_t width, height;
+    int sample_rate;
+    PixelSampleMethod psm;
+    LevelSampleMethod lsm;
+    unsigned int max_aniso;
+    StrokeMode stroke_mode;
+    bool occlusion_culling;
+    bool progressive;
+  };
+
+  // Background rendering. The event callbacks leave the latest request in
+  // request, replacing any that was not started yet; a pending pan is kept
+  // as the offset from the frame before it, and a full redraw cancels the
+  // frame in flight. Finished frames are copied from framebuffer, which
+  // only the render thread touches, into stream for render() to show,
+  // unless a newer request is already waiting, and into display for the
+  // zoom window and screenshots. While refining a preview,
+  // any request cancels the frame.
+  std::thread render_thread;
+  std::mutex state_mutex;
+  std::condition_variable frame_requested;
+  FrameRequest request;
+  bool pending, pending_full, refining, quit;
+  int pending_dx, pending_dy;
+  std::atomic<bool> cancel;
+  FrameStream stream;
+  std::vector<unsigned char> display;
+  size_t display_width, display_height;
+
+  // the magnified view, only used on the GL thread
+  FrameStream zoom_stream;
+
+  // Held while the rasterizer draws. drawn is the request the rasterizer
+  // buffers hold, if frame_valid, i.e. if its frame was not cancelled.
+  std::mutex raster_mutex;
+  FrameRequest drawn;
+  bool frame_valid;
+
+  // What drawing the last frame took, and loading the SVGs before it.
+  // Guarded by state_mutex.
+  RenderStats frame_stats;
+
+  // Copies the stats the calling thread kept while drawing to frame_stats
+  void snapshot_stats();
+
+  FrameRequest current_frame() const;
+
+  // Sets the size of the screen and the transform to it, without drawing
+  void set_screen_size(size_t w, size_t h);
+
+  // Passes the settings of f on to the rasterizer
+  void configure_rasterizer(const FrameRequest& f);
+
+  // Asks for a frame of the current view; in synchronous mode it is drawn
+  // before returning
+  void request_frame(bool full, int dx = 0, int dy = 0);
+  void render_loop();
+
+  // Draws f into framebuffer, shifting the previous frame by (dx, dy)
+  // unless full is set. Returns false if the frame was cancelled.
+  bool draw_frame(const FrameRequest& f, int dx, int dy, bool full);
+
+  // Copies framebuffer to stream and display
+  void publish();
+
+  // The top left corner of the region of display the zoom window shows,
+  // and its size in pixels and on screen. False if display is too small.
+  bool zoom_region(size_t& x0, size_t& y0, size_t& size, size_t& zoom_size);
+
+  // draws the tab of f into the cleared or scrolled frame
+  void draw_scene(const FrameRequest& f);
 };
 
 } // namespace CGL
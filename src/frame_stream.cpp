@@ -0,0 +1,181 @@
+#include "frame_stream.h"
+
+#include <cstring>
+
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+namespace CGL {
+
+void rgb_to_rgba(const unsigned char* rgb, unsigned char* rgba, size_t n) {
+  size_t i = 0;
+#ifdef __AVX__
+  // 16 bytes hold five and a third pixels; the first four are spread out
+  // to a 32 bit stride and given an opaque alpha
+  const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+                                       6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i alpha = _mm_set1_epi32(0xff000000);
+  for (; i + 6 <= n; i += 4) {
+    __m128i p = _mm_loadu_si128((const __m128i*)(rgb + 3 * i));
+    p = _mm_or_si128(_mm_shuffle_epi8(p, spread), alpha);
+    _mm_storeu_si128((__m128i*)(rgba + 4 * i), p);
+  }
+#endif
+  for (; i < n; ++i) {
+    rgba[4 * i]     = rgb[3 * i];
+    rgba[4 * i + 1] = rgb[3 * i + 1];
+    rgba[4 * i + 2] = rgb[3 * i + 2];
+    rgba[4 * i + 3] = 255;
+  }
+}
+
+FrameStream::FrameStream()
+: initialized(false), use_pbo(false), width(0), height(0),
+  texture(0), pbo(0), mapped(NULL),
+  writable(-1), acquired(-1), ready(-1),
+  client_width(0), client_height(0), client_ready(false)
+{
+  for (int s = 0; s < kSlots; ++s) fences[s] = 0;
+}
+
+FrameStream::~FrameStream() {
+  if (!initialized) return;
+  release_slots();
+  glDeleteTextures(1, &texture);
+}
+
+unsigned char* FrameStream::acquire(size_t w, size_t h) {
+  if (mapped && writable >= 0 && w == width && h == height) {
+    acquired = writable;
+    return mapped + acquired * slot_size();
+  }
+  acquired = -1;
+  client.resize(4 * w * h);
+  client_width = w; client_height = h;
+  return client.data();
+}
+
+void FrameStream::submit() {
+  if (acquired >= 0) {
+    // a frame still waiting was never uploaded, its slot is free
+    writable = ready;
+    ready = acquired;
+    acquired = -1;
+    client_ready = false;
+  } else {
+    ready = -1;
+    client_ready = true;
+  }
+}
+
+void FrameStream::update() {
+  if (!initialized) {
+    glGenTextures(1, &texture);
+    use_pbo = GLEW_ARB_buffer_storage && GLEW_ARB_sync;
+    initialized = true;
+  }
+
+  if (client_ready) {
+    if (client_width != width || client_height != height)
+      allocate(client_width, client_height);
+    if (use_pbo) glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height,
+                    GL_RGBA, GL_UNSIGNED_BYTE, client.data());
+    client_ready = false;
+  } else if (ready >= 0) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height,
+                    GL_RGBA, GL_UNSIGNED_BYTE, (const void*)(ready * slot_size()));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    fences[ready] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ready = -1;
+  }
+
+  // hand out a slot whose last upload has finished
+  if (!mapped || writable >= 0) return;
+  for (int s = 0; s < kSlots; ++s) {
+    if (s == ready) continue;
+    if (fences[s]) {
+      if (glClientWaitSync(fences[s], 0, 0) == GL_TIMEOUT_EXPIRED) continue;
+      glDeleteSync(fences[s]);
+      fences[s] = 0;
+    }
+    writable = s;
+    return;
+  }
+}
+
+void FrameStream::draw(int x, int y) {
+  if (!width || !height) return;
+
+  glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT | GL_TEXTURE_BIT);
+  glViewport(x, y, width, height);
+
+  glMatrixMode(GL_PROJECTION); glPushMatrix(); glLoadIdentity();
+  glMatrixMode(GL_MODELVIEW); glPushMatrix(); glLoadIdentity();
+
+  glEnable(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+
+  // the first row of the texture is the top of the frame
+  glBegin(GL_QUADS);
+  glTexCoord2f(0, 1); glVertex2f(-1, -1);
+  glTexCoord2f(1, 1); glVertex2f( 1, -1);
+  glTexCoord2f(1, 0); glVertex2f( 1,  1);
+  glTexCoord2f(0, 0); glVertex2f(-1,  1);
+  glEnd();
+
+  glMatrixMode(GL_PROJECTION); glPopMatrix();
+  glMatrixMode(GL_MODELVIEW); glPopMatrix();
+  glPopAttrib();
+}
+
+void FrameStream::allocate(size_t w, size_t h) {
+  width = w; height = h;
+
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+  if (!use_pbo) return;
+  release_slots();
+  if (!w || !h) return;
+
+  GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  glGenBuffers(1, &pbo);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+  glBufferStorage(GL_PIXEL_UNPACK_BUFFER, kSlots * slot_size(), NULL, flags);
+  mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, kSlots * slot_size(), flags);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  if (!mapped) {
+    glDeleteBuffers(1, &pbo);
+    pbo = 0;
+  }
+}
+
+void FrameStream::release_slots() {
+  for (int s = 0; s < kSlots; ++s) {
+    if (fences[s]) glDeleteSync(fences[s]);
+    fences[s] = 0;
+  }
+  if (pbo) {
+    if (mapped) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &pbo);
+  }
+  pbo = 0;
+  mapped = NULL;
+  writable = acquired = ready = -1;
+}
+
+} // namespace CGL
@@ -0,0 +1,79 @@
+#ifndef CGL_FRAME_STREAM_H
+#define CGL_FRAME_STREAM_H
+
+#include <vector>
+#include <cstddef>
+
+#include "GL/glew.h"
+
+namespace CGL {
+
+/**
+ * Converts n RGB pixels to RGBA, with alpha 255.
+ * With AVX, four pixels are shuffled into place per instruction.
+ */
+void rgb_to_rgba(const unsigned char* rgb, unsigned char* rgba, size_t n);
+
+/**
+ * Streams frames drawn on the CPU to the screen through a texture.
+ *
+ * Frames are written by the producer into a ring of slots of a pixel
+ * buffer object that stays mapped, and the texture is updated from there
+ * without the driver copying the pixels on the calling thread. A fence per
+ * slot tells when its upload is done and it can be written again. Where
+ * ARB_buffer_storage or ARB_sync are missing, or when no slot of the right
+ * size is free, frames go through client memory instead.
+ *
+ * acquire and submit may be called from any thread, update and draw only
+ * from the one with the GL context; the caller serializes all four.
+ */
+class FrameStream {
+ public:
+  FrameStream();
+  ~FrameStream();
+
+  // Returns memory for the next w x h frame, as RGBA rows from the top
+  unsigned char* acquire(size_t w, size_t h);
+
+  // Makes the frame written to the last acquired memory the newest
+  void submit();
+
+  // Uploads the newest frame to the texture, if it changed
+  void update();
+
+  // Draws the last uploaded frame with its lower left corner at window
+  // pixel (x, y)
+  void draw(int x = 0, int y = 0);
+
+ private:
+  static const int kSlots = 3;
+
+  bool initialized;
+  bool use_pbo;
+
+  // size of the texture and of the slots
+  size_t width, height;
+
+  GLuint texture;
+  GLuint pbo;
+  unsigned char* mapped;
+  GLsync fences[kSlots];
+
+  // slots free to write, being written and waiting for upload, or -1
+  int writable, acquired, ready;
+
+  // frames that do not go through a slot
+  std::vector<unsigned char> client;
+  size_t client_width, client_height;
+  bool client_ready;
+
+  size_t slot_size() const { return 4 * width * height; }
+
+  // (Re)creates the texture and the slots for w x h frames
+  void allocate(size_t w, size_t h);
+  void release_slots();
+};
+
+} // namespace CGL
+
+#endif // CGL_FRAME_STREAM_H
@@ -0,0 +1,615 @@
+#include "image_writer.h"
+#include "CGL/lodepng.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cctype>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace std;
+
+namespace CGL {
+
+ImageFormat image_format_for_path(const string& path) {
+  size_t dot = path.find_last_of('.');
+  string ext = dot == string::npos ? "" : path.substr(dot + 1);
+  for (size_t i = 0; i < ext.size(); ++i) ext[i] = tolower(ext[i]);
+  if (ext == "ppm") return IMAGE_PPM;
+  if (ext == "pam") return IMAGE_PAM;
+  if (ext == "qoi") return IMAGE_QOI;
+  return IMAGE_PNG;
+}
+
+static inline void put_be32(unsigned char* p, uint32_t v) {
+  p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+// PNG //
+
+static inline unsigned char paeth(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  if (pa <= pb && pa <= pc) return a;
+  return pb <= pc ? b : c;
+}
+
+// Filters a row of n bytes into out, filter type first. prev is the row
+// above, or null for the first row. Unless only the none filter is
+// allowed, the filter whose output has the smallest sum of absolute
+// values, as signed bytes, is used. scratch holds 5n bytes.
+static void filter_row(const unsigned char* row, const unsigned char* prev, size_t n,
+                       unsigned char* out, unsigned char* scratch, bool none_only) {
+  if (none_only) {
+    out[0] = 0;
+    memcpy(out + 1, row, n);
+    return;
+  }
+
+  unsigned long sum[5] = { 0 };
+  for (size_t i = 0; i < n; ++i) {
+    int x = row[i];
+    int a = i >= 3 ? row[i - 3] : 0;
+    int b = prev ? prev[i] : 0;
+    int c = prev && i >= 3 ? prev[i - 3] : 0;
+    unsigned char v[5] = {
+      (unsigned char)x,
+      (unsigned char)(x - a),
+      (unsigned char)(x - b),
+      (unsigned char)(x - ((a + b) >> 1)),
+      (unsigned char)(x - paeth(a, b, c))
+    };
+    for (int t = 0; t < 5; ++t) {
+      scratch[t * n + i] = v[t];
+      sum[t] += abs((signed char)v[t]);
+    }
+  }
+
+  int best = 0;
+  for (int t = 1; t < 5; ++t) {
+    if (sum[t] < sum[best]) best = t;
+  }
+  out[0] = best;
+  memcpy(out + 1, scratch + best * n, n);
+}
+
+
+// lodepng, reading the RGB rows as they are. Its output for a given image
+// does not depend on whether it is passed as RGB or opaque RGBA.
+static int write_png_lodepng(const string& path, const unsigned char* rgb,
+                             size_t w, size_t h, int compression) {
+  lodepng::State state;
+  state.info_raw.colortype = LCT_RGB;
+  state.info_raw.bitdepth = 8;
+  if (compression == 0) {
+    state.encoder.zlibsettings.btype = 0;
+    state.encoder.zlibsettings.use_lz77 = 0;
+  } else if (compression > 0) {
+    state.encoder.zlibsettings.windowsize = compression < 4 ? 1024 : compression < 7 ? 2048 : 32768;
+    state.encoder.zlibsettings.lazymatching = compression >= 4;
+  }
+
+  vector<unsigned char> png;
+  unsigned error = lodepng::encode(png, rgb, w, h, state);
+  if (!error) error = lodepng::save_file(png, path);
+  return error;
+}
+
+#ifdef HAVE_ZLIB
+
+// Uncompressed bytes per chunk, rounded to whole rows
+static const size_t CHUNK_BYTES = 1 << 20;
+
+// Deflate window size; each chunk is primed with this much of the data
+// before it so that compression does not restart from nothing
+static const size_t WINDOW = 32768;
+
+struct DeflateChunk {
+  size_t y0, y1;
+  vector<unsigned char> data;
+  uLong adler;
+  size_t length;
+  bool failed;
+};
+
+// Filters and deflates rows [y0, y1) of the image as a raw deflate stream
+// that ends on a byte boundary, or with the final block if last
+static void deflate_chunk(const unsigned char* rgb, size_t w, int level,
+                          DeflateChunk& chunk, bool last) {
+  size_t n = 3 * w, stride = n + 1;
+  vector<unsigned char> scratch(5 * n);
+
+  // the rows before the chunk that fill the window are filtered again
+  size_t primed = min(chunk.y0, (WINDOW + stride - 1) / stride);
+  size_t first = chunk.y0 - primed;
+  vector<unsigned char> filtered((chunk.y1 - first) * stride);
+  for (size_t y = first; y < chunk.y1; ++y) {
+    filter_row(rgb + y * n, y ? rgb + (y - 1) * n : NULL, n,
+               &filtered[(y - first) * stride], scratch.data(), level == 0);
+  }
+  unsigned char* in = &filtered[primed * stride];
+  size_t in_length = (chunk.y1 - chunk.y0) * stride;
+
+  chunk.failed = true;
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  if (deflateInit2(&z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return;
+  if (primed) {
+    size_t d = min(WINDOW, primed * stride);
+    deflateSetDictionary(&z, in - d, d);
+  }
+
+  chunk.data.resize(deflateBound(&z, in_length) + 16);
+  z.next_in = in;
+  z.avail_in = in_length;
+  z.next_out = chunk.data.data();
+  z.avail_out = chunk.data.size();
+  while (true) {
+    int ret = deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH);
+    if (ret == Z_STREAM_ERROR) break;
+    if (last ? ret == Z_STREAM_END : z.avail_in == 0 && z.avail_out != 0) {
+      chunk.failed = false;
+      break;
+    }
+    size_t used = chunk.data.size() - z.avail_out;
+    chunk.data.resize(2 * chunk.data.size());
+    z.next_out = chunk.data.data() + used;
+    z.avail_out = chunk.data.size() - used;
+  }
+  chunk.data.resize(z.total_out);
+  deflateEnd(&z);
+
+  chunk.adler = adler32(adler32(0, NULL, 0), in, in_length);
+  chunk.length = in_length;
+}
+
+// Writes a PNG chunk whose data is prefix, data and suffix one after another
+static void write_png_chunk(FILE* f, const char* type,
+                            const unsigned char* prefix, size_t prefix_length,
+                            const unsigned char* data, size_t length,
+                            const unsigned char* suffix, size_t suffix_length) {
+  unsigned char head[8];
+  put_be32(head, prefix_length + length + suffix_length);
+  memcpy(head + 4, type, 4);
+  // crc32 restarts when given no buffer, so empty parts are skipped
+  uLong crc = crc32(crc32(0, NULL, 0), head + 4, 4);
+  if (prefix_length) crc = crc32(crc, prefix, prefix_length);
+  if (length) crc = crc32(crc, data, length);
+  if (suffix_length) crc = crc32(crc, suffix, suffix_length);
+  unsigned char tail[4];
+  put_be32(tail, crc);
+
+  fwrite(head, 1, 8, f);
+  fwrite(prefix, 1, prefix_length, f);
+  fwrite(data, 1, length, f);
+  fwrite(suffix, 1, suffix_length, f);
+  fwrite(tail, 1, 4, f);
+}
+
+// The image data is deflated in chunks of rows on separate threads, which
+// are joined into one zlib stream, one IDAT each
+static int write_png_chunked(FILE* f, const unsigned char* rgb, size_t w, size_t h,
+                             int level, unsigned int threads) {
+  size_t stride = 3 * w + 1;
+  size_t rows = max((size_t)1, CHUNK_BYTES / stride);
+  size_t count = (h + rows - 1) / rows;
+  vector<DeflateChunk> chunks(count);
+  for (size_t i = 0; i < count; ++i) {
+    chunks[i].y0 = i * rows;
+    chunks[i].y1 = min(h, (i + 1) * rows);
+  }
+
+  if (!threads) threads = thread::hardware_concurrency();
+  threads = max(1u, min(threads, (unsigned int)count));
+  atomic<size_t> next(0);
+  auto work = [&]() {
+    for (size_t i; (i = next++) < count; )
+      deflate_chunk(rgb, w, level, chunks[i], i + 1 == count);
+  };
+  vector<thread> workers;
+  for (unsigned int t = 1; t < threads; ++t)
+    workers.emplace_back(work);
+  work();
+  for (size_t t = 0; t < workers.size(); ++t)
+    workers[t].join();
+
+  uLong adler = chunks[0].adler;
+  for (size_t i = 0; i < count; ++i) {
+    if (chunks[i].failed) return 1;
+    if (i) adler = adler32_combine(adler, chunks[i].adler, chunks[i].length);
+  }
+
+  static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+  fwrite(signature, 1, 8, f);
+
+  unsigned char ihdr[13];
+  put_be32(ihdr, w);
+  put_be32(ihdr + 4, h);
+  ihdr[8] = 8;  // bit depth
+  ihdr[9] = 2;  // RGB
+  ihdr[10] = ihdr[11] = ihdr[12] = 0;
+  write_png_chunk(f, "IHDR", NULL, 0, ihdr, 13, NULL, 0);
+
+  // zlib header with the level hint zlib itself writes, and the checksum
+  // of all the data at the end
+  unsigned char header[2] = { 0x78, (unsigned char)(level < 2 ? 0x01 : level < 6 ? 0x5e : level == 6 ? 0x9c : 0xda) };
+  unsigned char checksum[4];
+  put_be32(checksum, adler);
+  for (size_t i = 0; i < count; ++i) {
+    bool first = i == 0, last = i + 1 == count;
+    write_png_chunk(f, "IDAT", header, first ? 2 : 0,
+                    chunks[i].data.data(), chunks[i].data.size(), checksum, last ? 4 : 0);
+  }
+
+  write_png_chunk(f, "IEND", NULL, 0, NULL, 0, NULL, 0);
+  return ferror(f) != 0;
+}
+
+#endif // HAVE_ZLIB
+
+// Row encoders //
+
+class RowEncoder {
+ public:
+  virtual ~RowEncoder() { }
+
+  // Writes the header of a w x h image
+  virtual int begin(FILE* f, size_t w, size_t h) = 0;
+
+  // Encodes the next n rows
+  virtual int write(FILE* f, const unsigned char* rgb, size_t n) = 0;
+
+  // Writes what is left once every row is in
+  virtual int finish(FILE* f) = 0;
+};
+
+class NetpbmEncoder : public RowEncoder {
+ public:
+  NetpbmEncoder(ImageFormat format) : format(format), width(0) { }
+
+  int begin(FILE* f, size_t w, size_t h) {
+    width = w;
+    if (format == IMAGE_PPM)
+      return fprintf(f, "P6\n%zu %zu\n255\n", w, h) < 0;
+    return fprintf(f, "P7\nWIDTH %zu\nHEIGHT %zu\nDEPTH 3\nMAXVAL 255\nTUPLTYPE RGB\nENDHDR\n", w, h) < 0;
+  }
+
+  int write(FILE* f, const unsigned char* rgb, size_t n) {
+    return fwrite(rgb, 3 * width, n, f) != n;
+  }
+
+  int finish(FILE* f) { return 0; }
+
+ private:
+  ImageFormat format;
+  size_t width;
+};
+
+class QoiEncoder : public RowEncoder {
+ public:
+  QoiEncoder() : width(0), prev(0xff000000u), run(0) {
+    // the index starts out all zero, which no opaque pixel matches
+    memset(index, 0, sizeof(index));
+  }
+
+  int begin(FILE* f, size_t w, size_t h) {
+    width = w;
+    unsigned char header[14] = { 'q', 'o', 'i', 'f' };
+    put_be32(header + 4, w);
+    put_be32(header + 8, h);
+    header[12] = 3; // channels
+    header[13] = 0; // sRGB
+    return fwrite(header, 1, 14, f) != 14;
+  }
+
+  int write(FILE* f, const unsigned char* rgb, size_t n) {
+    out.reserve(BLOCK + 16);
+    for (size_t i = 0; i < n * width; ++i) {
+      const unsigned char* p = rgb + 3 * i;
+      uint32_t px = p[0] | p[1] << 8 | p[2] << 16 | 0xff000000u;
+
+      if (px == prev) {
+        if (++run == 62) flush_run();
+      } else {
+        flush_run();
+        int slot = (p[0] * 3 + p[1] * 5 + p[2] * 7 + 255 * 11) % 64;
+        if (index[slot] == px) {
+          out.push_back(slot);
+        } else {
+          index[slot] = px;
+          signed char vr = p[0] - (unsigned char)prev;
+          signed char vg = p[1] - (unsigned char)(prev >> 8);
+          signed char vb = p[2] - (unsigned char)(prev >> 16);
+          signed char vg_r = vr - vg, vg_b = vb - vg;
+          if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+            out.push_back(0x40 | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+          } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+            out.push_back(0x80 | (vg + 32));
+            out.push_back((vg_r + 8) << 4 | (vg_b + 8));
+          } else {
+            unsigned char op[4] = { 0xfe, p[0], p[1], p[2] };
+            out.insert(out.end(), op, op + 4);
+          }
+        }
+      }
+      prev = px;
+
+      if (out.size() >= BLOCK && flush(f)) return 1;
+    }
+    return 0;
+  }
+
+  int finish(FILE* f) {
+    flush_run();
+    static const unsigned char end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    out.insert(out.end(), end, end + 8);
+    return flush(f);
+  }
+
+ private:
+  // output is written to the file in blocks of about this size
+  static const size_t BLOCK = 1 << 16;
+
+  // pixels are packed as r, g, b, a from the low byte
+  size_t width;
+  uint32_t index[64];
+  uint32_t prev;
+  int run;
+  vector<unsigned char> out;
+
+  void flush_run() {
+    if (run) out.push_back(0xc0 | (run - 1));
+    run = 0;
+  }
+
+  int flush(FILE* f) {
+    size_t n = out.size();
+    bool error = fwrite(out.data(), 1, n, f) != n;
+    out.clear();
+    return error;
+  }
+};
+
+// Writes a PNG chunk from its type followed by length bytes of data
+static int write_chunk(FILE* f, const unsigned char* chunk, size_t length) {
+  unsigned char head[4], tail[4];
+  put_be32(head, length);
+#ifdef HAVE_ZLIB
+  put_be32(tail, crc32(crc32(0, NULL, 0), chunk, length + 4));
+#else
+  put_be32(tail, lodepng_crc32(chunk, length + 4));
+#endif
+  return fwrite(head, 1, 4, f) != 4 || fwrite(chunk, 1, length + 4, f) != length + 4
+      || fwrite(tail, 1, 4, f) != 4;
+}
+
+// A PNG written as one zlib stream, split into IDAT chunks as it is
+// produced. Without zlib the rows are stored uncompressed, in stored
+// deflate blocks.
+class PngEncoder : public RowEncoder {
+ public:
+  PngEncoder(int compression) : level(compression), started(false), stride(0), rows(0) {
+#ifndef HAVE_ZLIB
+    adler_a = 1; adler_b = 0;
+#endif
+  }
+
+  ~PngEncoder() {
+#ifdef HAVE_ZLIB
+    if (started) deflateEnd(&z);
+#endif
+  }
+
+  int begin(FILE* f, size_t w, size_t h) {
+    stride = 3 * w;
+    prev.resize(stride);
+    filtered.resize(stride + 1);
+    scratch.resize(5 * stride);
+    idat.assign((const unsigned char*)"IDAT", (const unsigned char*)"IDAT" + 4);
+    idat.reserve(IDAT_BYTES + 4);
+
+    static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    unsigned char ihdr[17] = { 'I', 'H', 'D', 'R' };
+    put_be32(ihdr + 4, w);
+    put_be32(ihdr + 8, h);
+    ihdr[12] = 8;  // bit depth
+    ihdr[13] = 2;  // RGB
+    if (fwrite(signature, 1, 8, f) != 8 || write_chunk(f, ihdr, 13)) return 1;
+
+#ifdef HAVE_ZLIB
+    memset(&z, 0, sizeof(z));
+    if (deflateInit(&z, level < 0 ? Z_DEFAULT_COMPRESSION : level) != Z_OK) return 1;
+#else
+    static const unsigned char header[2] = { 0x78, 0x01 };
+    if (put(f, header, 2)) return 1;
+#endif
+    started = true;
+    return 0;
+  }
+
+  int write(FILE* f, const unsigned char* rgb, size_t n) {
+    for (size_t y = 0; y < n; ++y) {
+      const unsigned char* row = rgb + y * stride;
+      filter_row(row, rows ? prev.data() : NULL, stride, filtered.data(), scratch.data(), level == 0);
+      memcpy(prev.data(), row, stride);
+      ++rows;
+      if (compress(f, filtered.data(), stride + 1, false)) return 1;
+    }
+    return 0;
+  }
+
+  int finish(FILE* f) {
+    if (compress(f, NULL, 0, true)) return 1;
+    if (idat.size() > 4 && write_chunk(f, idat.data(), idat.size() - 4)) return 1;
+    static const unsigned char iend[4] = { 'I', 'E', 'N', 'D' };
+    return write_chunk(f, iend, 0);
+  }
+
+ private:
+  // Compressed bytes per IDAT chunk
+  static const size_t IDAT_BYTES = 1 << 16;
+
+  int level;
+  bool started;
+  size_t stride, rows;
+  vector<unsigned char> prev, filtered, scratch;
+
+  // type and data of the IDAT chunk being filled
+  vector<unsigned char> idat;
+
+#ifdef HAVE_ZLIB
+  z_stream z;
+  unsigned char buffer[IDAT_BYTES];
+#else
+  // the data of the stored block being filled, and the running checksum
+  vector<unsigned char> block;
+  uint32_t adler_a, adler_b;
+#endif
+
+  // Appends compressed data to the IDAT chunks
+  int put(FILE* f, const unsigned char* data, size_t n) {
+    while (n) {
+      size_t k = min(n, IDAT_BYTES + 4 - idat.size());
+      idat.insert(idat.end(), data, data + k);
+      data += k; n -= k;
+      if (idat.size() == IDAT_BYTES + 4) {
+        if (write_chunk(f, idat.data(), IDAT_BYTES)) return 1;
+        idat.resize(4);
+      }
+    }
+    return 0;
+  }
+
+#ifdef HAVE_ZLIB
+  int compress(FILE* f, const unsigned char* data, size_t n, bool last) {
+    z.next_in = (Bytef*)data;
+    z.avail_in = n;
+    while (true) {
+      z.next_out = buffer;
+      z.avail_out = IDAT_BYTES;
+      int ret = deflate(&z, last ? Z_FINISH : Z_NO_FLUSH);
+      if (ret == Z_STREAM_ERROR) return 1;
+      if (put(f, buffer, IDAT_BYTES - z.avail_out)) return 1;
+      if (last ? ret == Z_STREAM_END : z.avail_in == 0 && z.avail_out != 0) return 0;
+    }
+  }
+#else
+  int compress(FILE* f, const unsigned char* data, size_t n, bool last) {
+    // the Adler-32 sums, reduced before they can overflow
+    for (size_t i = 0; i < n; ) {
+      size_t end = min(n, i + 5552);
+      for (; i < end; ++i) { adler_a += data[i]; adler_b += adler_a; }
+      adler_a %= 65521; adler_b %= 65521;
+    }
+
+    while (n || last) {
+      size_t k = min(n, (size_t)65535 - block.size());
+      block.insert(block.end(), data, data + k);
+      data += k; n -= k;
+      bool final = last && !n;
+      if (block.size() < 65535 && !final) break;
+
+      unsigned char head[5] = { (unsigned char)final,
+                                (unsigned char)block.size(), (unsigned char)(block.size() >> 8) };
+      head[3] = ~head[1]; head[4] = ~head[2];
+      if (put(f, head, 5) || put(f, block.data(), block.size())) return 1;
+      block.clear();
+      if (final) {
+        unsigned char checksum[4];
+        put_be32(checksum, adler_b << 16 | adler_a);
+        return put(f, checksum, 4);
+      }
+    }
+    return 0;
+  }
+#endif
+};
+
+int write_image(const string& path, const unsigned char* rgb,
+                size_t w, size_t h, const ImageWriteOptions& options) {
+  if (!w || !h) return 1;
+
+  bool chunked = false;
+#ifdef HAVE_ZLIB
+  chunked = options.format == IMAGE_PNG && options.compression >= 0;
+#endif
+  if (options.format == IMAGE_PNG && !chunked)
+    return write_png_lodepng(path, rgb, w, h, options.compression);
+
+#ifdef HAVE_ZLIB
+  if (chunked) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return 1;
+    int error = write_png_chunked(f, rgb, w, h, min(options.compression, 9), options.threads);
+    if (fclose(f)) error = 1;
+    return error;
+  }
+#endif
+
+  ImageRowWriter writer;
+  if (writer.open(path, w, h, options)) return 1;
+  writer.write_rows(rgb, h);
+  return writer.close();
+}
+
+ImageRowWriter::ImageRowWriter()
+: file(NULL), encoder(NULL), width(0), height(0), rows(0), failed(false) { }
+
+ImageRowWriter::~ImageRowWriter() {
+  if (file) fclose(file);
+  delete encoder;
+}
+
+int ImageRowWriter::open(const string& path, size_t w, size_t h,
+                         const ImageWriteOptions& options) {
+  close();
+  if (!w || !h) return 1;
+  width = w; height = h; rows = 0;
+  failed = false;
+
+  switch (options.format) {
+    case IMAGE_PPM:
+    case IMAGE_PAM:
+      encoder = new NetpbmEncoder(options.format);
+      break;
+    case IMAGE_QOI:
+      encoder = new QoiEncoder();
+      break;
+    default:
+      encoder = new PngEncoder(min(options.compression, 9));
+      break;
+  }
+
+  file = fopen(path.c_str(), "wb");
+  failed = !file || encoder->begin(file, w, h);
+  return failed;
+}
+
+int ImageRowWriter::write_rows(const unsigned char* rgb, size_t n) {
+  if (!file || failed) return 1;
+  n = min(n, height - rows);
+  rows += n;
+  if (encoder->write(file, rgb, n)) failed = true;
+  return failed;
+}
+
+int ImageRowWriter::close() {
+  if (!encoder) return 1;
+  bool error = failed || !file || rows != height;
+  if (!error && encoder->finish(file)) error = true;
+  if (file && fclose(file)) error = true;
+  file = NULL;
+  delete encoder;
+  encoder = NULL;
+  return error;
+}
+
+} // namespace CGL
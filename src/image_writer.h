@@ -0,0 +1,74 @@
+#ifndef CGL_IMAGE_WRITER_H
+#define CGL_IMAGE_WRITER_H
+
+#include <string>
+#include <cstddef>
+#include <cstdio>
+
+namespace CGL {
+
+enum ImageFormat {
+  IMAGE_PNG = 0,
+  IMAGE_PPM = 1, // binary portable pixmap, P6
+  IMAGE_PAM = 2, // portable arbitrary map, P7 with TUPLTYPE RGB
+  IMAGE_QOI = 3  // the Quite OK Image format
+};
+
+struct ImageWriteOptions {
+  ImageFormat format;
+
+  // PNG only. -1 uses lodepng at its default settings, which the
+  // reference images are compared against byte for byte. 0 (stored) to 9
+  // (smallest) compress the rows in chunks on several threads, each
+  // chunk primed with the end of the one before it.
+  int compression;
+
+  // Threads for chunked PNG compression, 0 for one per core
+  unsigned int threads;
+
+  ImageWriteOptions() : format(IMAGE_PNG), compression(-1), threads(0) { }
+};
+
+// The format for the extension of path; PNG if it is not known
+ImageFormat image_format_for_path(const std::string& path);
+
+// Writes a w x h RGB image, 3 bytes per pixel in rows from the top, to
+// path. Returns 0 on success, nonzero otherwise.
+int write_image(const std::string& path, const unsigned char* rgb,
+                size_t w, size_t h, const ImageWriteOptions& options);
+
+class RowEncoder;
+
+/**
+ * Writes an image to a file a few rows at a time, for images too large to
+ * hold in memory at once. Only the rows being encoded are kept.
+ *
+ * PNGs are deflated as one stream at the given compression level, or at
+ * zlib's default for -1, since lodepng needs the whole image. Without
+ * zlib they are written uncompressed.
+ */
+class ImageRowWriter {
+ public:
+  ImageRowWriter();
+  ~ImageRowWriter();
+
+  // Starts a w x h image at path. Returns 0 on success.
+  int open(const std::string& path, size_t w, size_t h,
+           const ImageWriteOptions& options);
+
+  // Appends n RGB rows, 3 bytes per pixel. Returns 0 on success.
+  int write_rows(const unsigned char* rgb, size_t n);
+
+  // Finishes and closes the file. Returns 0 if all h rows were written.
+  int close();
+
+ private:
+  FILE* file;
+  RowEncoder* encoder;
+  size_t width, height, rows;
+  bool failed;
+};
+
+} // namespace CGL
+
+#endif // CGL_IMAGE_WRITER_H
@@ -117,11 +117,40 @@ int main( int argc, char** argv ) {
   // create application
   DrawRend app(svgs);
 
-  if (argc > 4 && strcmp(argv[2],"nogl") == 0) {
+  // nogl draws the whole frame, banded a few rows at a time for images
+  // too large to hold in memory
+  bool banded = argc > 4 && strcmp(argv[2],"banded") == 0;
+  if (argc > 4 && (banded || strcmp(argv[2],"nogl") == 0)) {
     app.init();
     app.set_gl(false);
-    app.resize(stoi(argv[3]), stoi(argv[4]));
-    app.write_framebuffer();
+
+    // optionally an output file, whose extension picks the format, and
+    // a PNG compression level from 0 to 9, or -1 for lodepng
+    string output = argc > 5 ? argv[5] : "test.png";
+    ImageWriteOptions options;
+    options.format = image_format_for_path(output);
+    if (argc > 6) options.compression = stoi(argv[6]);
+    if (options.compression < -1 || options.compression > 9) {
+      msg("Compression level must be between -1 and 9; -1 selects lodepng.");
+      return 0;
+    }
+
+    if (banded) {
+      // and the sample rate, 1, 4, 9 or 16
+      int rate = argc > 7 ? stoi(argv[7]) : 1;
+      if (rate != 1 && rate != 4 && rate != 9 && rate != 16) {
+        msg("Sample rate must be 1, 4, 9 or 16.");
+        return 0;
+      }
+      app.set_sample_rate(rate);
+      app.write_banded(output, stoi(argv[3]), stoi(argv[4]), options);
+    } else {
+      app.resize(stoi(argv[3]), stoi(argv[4]));
+      app.write_framebuffer(output, options);
+    }
+
+    // in builds with DRAW_STATS, the stats of the frame go next to it
+    app.write_stats(output + ".stats.json");
     return 0;
   }
 
@@ -1,4 +1,9 @@
 #include "rasterizer.h"
+#include "stroke.h"
+#include "render_stats.h"
+
+#include <climits>
+#include <cstring>
 
 using namespace std;
 
@@ -9,10 +14,59 @@ namespace CGL {
                                  unsigned int sample_rate) {
         this->psm = psm;
         this->lsm = lsm;
+        this->max_aniso = kDefaultMaxAnisotropy;
+        this->stroke_mode = S_HAIRLINE;
+        this->current_stroke = this->stroke_ids = 0;
+        this->drawn_stroke = this->stroke_serial = this->stroke_serials = 0;
         this->width = width;
         this->height = height;
         this->sample_rate = sample_rate;
-        sample_buffer.resize(width * height * sample_rate, Color::White);
+        this->occlusion_culling = false;
+        this->replaying = false;
+        this->commands_pending = false;
+        this->retained = false;
+        this->current_tag = 0;
+        this->updating = false;
+        this->index_valid = false;
+        this->row_index_valid = false;
+        this->cancel_flag = nullptr;
+        this->band_y0 = 0;
+        this->band_y1 = height;
+        resize_sample_buffer();
+    }
+
+    template <bool BLEND>
+    inline void RasterizerImp::write_sample(size_t i, const Color& src) {
+        if (!BLEND) {
+            sample_buffer[i] = src;
+            return;
+        }
+        if (stroke_serial) {
+            if (stroke_stamp[i] == stroke_serial) return;
+            stroke_stamp[i] = stroke_serial;
+        }
+        sample_buffer[i] = src.over(sample_buffer[i]);
+    }
+
+    void RasterizerImp::begin_stroke(unsigned int id) {
+        drawn_stroke = id;
+        if (!id) {
+            stroke_serial = 0;
+            return;
+        }
+        // stamps from earlier serials never match; start over if they wrap
+        if (stroke_stamp.size() != sample_buffer.size() || ++stroke_serials == 0) {
+            stroke_stamp.assign(sample_buffer.size(), 0);
+            stroke_serials = 1;
+        }
+        stroke_serial = stroke_serials;
+    }
+
+    // Points and lines write whole pixels, which are either entirely inside
+    // the scissor or entirely outside when it is set for a region redraw
+    bool RasterizerImp::pixel_in_scissor(size_t x, size_t y, int rate) const {
+        int sx = x * rate, sy = y * rate;
+        return sx >= scissor.x0 && sx < scissor.x1 && sy >= scissor.y0 && sy < scissor.y1;
     }
 
     // Used by rasterize_point and rasterize_line
@@ -20,15 +74,45 @@ namespace CGL {
         
         // NOTE: You are not required to implement proper supersampling for points and lines
         // It is sufficient to use the same color for all supersamples of a pixel for points and lines (not triangles)
-        int start = y * width * sample_rate + x * sqrt(sample_rate);
-        for (int col = 0; col < sqrt(sample_rate); ++col) {
-            for (int row = 0; row < sqrt(sample_rate); ++row) {
-                sample_buffer[start + row*sample_rate*width + col] = c;
+        int rate = sqrt(sample_rate);
+        if (!pixel_in_scissor(x, y, rate)) return;
+        STATS_ADD(samples_written, rate * rate);
+        size_t start = sample_index(x * rate, y * rate, rate);
+        if (c.a >= 1) {
+            for (int row = 0; row < rate; ++row) {
+                for (int col = 0; col < rate; ++col) {
+                    sample_buffer[start + row * rate * width + col] = c;
+                }
+            }
+            return;
+        }
+        for (int row = 0; row < rate; ++row) {
+            for (int col = 0; col < rate; ++col) {
+                write_sample<true>(start + row * rate * width + col, c);
+            }
+        }
+    }
+
+    void RasterizerImp::blend_pixel(size_t x, size_t y, Color c, float coverage) {
+        int rate = sqrt(sample_rate);
+        if (!pixel_in_scissor(x, y, rate)) return;
+        STATS_ADD(samples_written, rate * rate);
+        size_t start = sample_index(x * rate, y * rate, rate);
+        c *= coverage;
+        for (int row = 0; row < rate; ++row) {
+            for (int col = 0; col < rate; ++col) {
+                write_sample<true>(start + row * rate * width + col, c);
             }
         }
     }
 
     void RasterizerImp::rasterize_point(float x, float y, Color color) {
+        if (!replaying) STATS_ADD(primitives[RenderStats::POINTS], 1);
+        if (color.a <= 0) return;
+        if (recording()) {
+            record({ DrawCommand::POINT, { x, y }, { color } });
+            return;
+        }
         // fill in the nearest pixel
         int sx = (int)floor(x);
         int sy = (int)floor(y);
@@ -40,34 +124,368 @@ namespace CGL {
         return;
     }
 
+    // Cohen-Sutherland region codes
+    enum { OUT_LEFT = 1, OUT_RIGHT = 2, OUT_TOP = 4, OUT_BOTTOM = 8 };
+
+    static inline int outcode(float x, float y, float xmin, float ymin, float xmax, float ymax) {
+        int code = 0;
+        if (x < xmin) code |= OUT_LEFT; else if (x > xmax) code |= OUT_RIGHT;
+        if (y < ymin) code |= OUT_TOP;  else if (y > ymax) code |= OUT_BOTTOM;
+        return code;
+    }
+
+    // Cohen-Sutherland clipping of a segment to [xmin, xmax] x [ymin, ymax].
+    // Returns false if the segment misses the box entirely.
+    static bool clip_line(float& x0, float& y0, float& x1, float& y1,
+                          float xmin, float ymin, float xmax, float ymax) {
+        int c0 = outcode(x0, y0, xmin, ymin, xmax, ymax);
+        int c1 = outcode(x1, y1, xmin, ymin, xmax, ymax);
+        while (c0 | c1) {
+            if (c0 & c1) return false;
+
+            // move an outside endpoint onto the edge it is beyond
+            int c = c0 ? c0 : c1;
+            double x, y;
+            double dx = (double)x1 - x0, dy = (double)y1 - y0;
+            if (c & OUT_LEFT)        { x = xmin; y = y0 + dy * (xmin - x0) / dx; }
+            else if (c & OUT_RIGHT)  { x = xmax; y = y0 + dy * (xmax - x0) / dx; }
+            else if (c & OUT_TOP)    { y = ymin; x = x0 + dx * (ymin - y0) / dy; }
+            else                     { y = ymax; x = x0 + dx * (ymax - y0) / dy; }
+
+            if (c == c0) { x0 = x; y0 = y; c0 = outcode(x0, y0, xmin, ymin, xmax, ymax) & ~c; }
+            else         { x1 = x; y1 = y; c1 = outcode(x1, y1, xmin, ymin, xmax, ymax) & ~c; }
+        }
+        return true;
+    }
+
+    // Floor of a / b for b > 0
+    static inline long long floor_div(long long a, long long b) {
+        return a >= 0 ? a / b : -((b - 1 - a) / b);
+    }
+
     // Rasterize a line.
+    // Steps one pixel at a time along the major axis starting at (x0, y0),
+    // while the minor coordinate advances by the slope in 32.32 fixed point.
+    // The range of steps that lands inside the framebuffer, or the band of
+    // it that is kept, is worked out once up front, so the loop itself
+    // needs no bounds checks.
     void RasterizerImp::rasterize_line(float x0, float y0,
                                        float x1, float y1,
                                        Color color) {
+        if (!replaying) STATS_ADD(primitives[RenderStats::LINES], 1);
+
+        // trivially reject invisible lines and lines entirely to one side of
+        // the framebuffer. Non-finite endpoints are dropped here, before
+        // anything is recorded or either line path converts them to integers.
+        if (color.a <= 0) return;
+        if (!isfinite(x0) || !isfinite(y0) || !isfinite(x1) || !isfinite(y1)) return;
+        if (outcode(x0, y0, 0, 0, width, height) & outcode(x1, y1, 0, 0, width, height)) return;
+
+        if (recording()) {
+            record({ DrawCommand::LINE, { x0, y0, x1, y1 }, { color } });
+            return;
+        }
+
+        if (stroke_mode == S_SMOOTH_HAIRLINE) {
+            rasterize_smooth_line(x0, y0, x1, y1, color);
+            return;
+        }
+
+        // Clip to the guard band first, so the coordinates converted to
+        // integers below are in range however far away the endpoints are.
+        // Lines inside it are left exactly as they are.
+        if (!clip_line(x0, y0, x1, y1, -kGuardBand, -kGuardBand,
+                       width + kGuardBand, height + kGuardBand)) return;
+
         if (x0 > x1) {
             swap(x0, x1); swap(y0, y1);
         }
+        float dx = x1 - x0, dy = y1 - y0;
+        bool steep = abs(dy) > dx;
+
+        // major axis pixel p0 + k * dir, minor axis floor(m0 + k * slope),
+        // for k = 0 .. steps, each kept within [lo, hi)
+        long long p0, steps, major_lo, major_hi, minor_lo, minor_hi;
+        int dir;
+        double m0, slope;
+        if (steep) {
+            p0 = (long long)floor(y0); dir = dy > 0 ? 1 : -1;
+            steps = (long long)floor(abs(dy));
+            m0 = x0; slope = dx / abs(dy);
+            major_lo = band_y0; major_hi = band_y1;
+            minor_lo = 0; minor_hi = width;
+        } else {
+            p0 = (long long)floor(x0); dir = 1;
+            steps = (long long)floor(x1) - p0;
+            if (dy != 0) steps = min(steps, (long long)floor(dx));
+            m0 = y0; slope = dx > 0 ? dy / dx : 0;
+            major_lo = 0; major_hi = width;
+            minor_lo = band_y0; minor_hi = band_y1;
+        }
+
+        // clip the major axis
+        long long k0 = 0, k1 = steps;
+        if (dir > 0) {
+            k0 = max(k0, major_lo - p0); k1 = min(k1, major_hi - 1 - p0);
+        } else {
+            k0 = max(k0, p0 - (major_hi - 1)); k1 = min(k1, p0 - major_lo);
+        }
+        if (k0 > k1) return;
+
+        // Minor coordinate at step k0 + j is base + ((f + j * s) >> 32). Over
+        // the clipped range it moves by at most k1 - k0 pixels, which bounds
+        // how far off screen base can start and still reach the framebuffer.
+        double start = m0 + k0 * slope;
+        if (start < minor_lo - (double)(k1 - k0 + 1) || start > (double)(minor_hi + k1 - k0 + 1)) return;
+        long long base = (long long)floor(start);
+        long long f = (long long)((start - base) * 4294967296.0);
+        long long s = (long long)llround(slope * 4294967296.0);
+
+        // clip the minor axis: need lo <= f + j * s < hi
+        long long lo = (minor_lo - base) * 4294967296LL, hi = (minor_hi - base) * 4294967296LL;
+        long long j0 = 0, j1 = k1 - k0;
+        if (s > 0) {
+            j0 = max(j0, floor_div(lo - f + s - 1, s));
+            j1 = min(j1, floor_div(hi - 1 - f, s));
+        } else if (s < 0) {
+            j0 = max(j0, floor_div(f - hi, -s) + 1);
+            j1 = min(j1, floor_div(f - lo, -s));
+        } else if (f < lo || f >= hi) {
+            return;
+        }
+
+        long long major = p0 + (k0 + j0) * dir;
+        long long acc = f + j0 * s;
+        for (long long j = j0; j <= j1; ++j) {
+            long long minor = base + (acc >> 32);
+            if (steep) fill_pixel(minor, major, color);
+            else       fill_pixel(major, minor, color);
+            major += dir; acc += s;
+        }
+    }
 
-        float pt[] = { x0,y0 };
-        float m = (y1 - y0) / (x1 - x0);
-        float dpt[] = { 1,m };
-        int steep = abs(m) > 1;
+    // Xiaolin Wu's line algorithm. Each step along the major axis covers the
+    // two pixels straddling the line, weighted by their distance from it,
+    // and the endpoints are weighted by how much of their pixel they cover.
+    // Coverage is blended into every sample of a pixel.
+    void RasterizerImp::rasterize_smooth_line(float x0, float y0,
+                                              float x1, float y1,
+                                              Color color) {
+        // Clip to the framebuffer plus a pixel of margin, which keeps the
+        // coverage of the border pixels the same as for the unclipped line.
+        if (!clip_line(x0, y0, x1, y1, -1, -1, width + 1, height + 1)) return;
+
+        bool steep = abs(y1 - y0) > abs(x1 - x0);
         if (steep) {
-            dpt[0] = x1 == x0 ? 0 : 1 / abs(m);
-            dpt[1] = x1 == x0 ? (y1 - y0) / abs(y1 - y0) : m / abs(m);
+            swap(x0, y0); swap(x1, y1);
+        }
+        if (x0 > x1) {
+            swap(x0, x1); swap(y0, y1);
+        }
+
+        // work relative to pixel centers
+        x0 -= 0.5f; y0 -= 0.5f; x1 -= 0.5f; y1 -= 0.5f;
+        float dx = x1 - x0;
+        double gradient = dx > 0 ? (y1 - y0) / dx : 0;
+
+        long long major_size = steep ? height : width;
+        long long minor_size = steep ? width : height;
+
+        // plots the pair of pixels around minor coordinate y in column x
+        auto plot = [&](long long x, double y, float weight) {
+            long long iy = (long long)floor(y);
+            float frac = y - iy;
+            for (int i = 0; i < 2; ++i) {
+                long long py = iy + i;
+                if (py < 0 || py >= minor_size) continue;
+                float coverage = (i ? frac : 1 - frac) * weight;
+                if (steep) blend_pixel(py, x, color, coverage);
+                else       blend_pixel(x, py, color, coverage);
+            }
+        };
+
+        long long first = (long long)floor(x0 + 0.5f);
+        long long last = (long long)floor(x1 + 0.5f);
+
+        // endpoints, weighted by the part of their pixel the line spans
+        if (first == last) {
+            if (first >= 0 && first < major_size)
+                plot(first, y0 + gradient * (first - x0), x1 - x0);
+            return;
         }
+        if (first >= 0 && first < major_size)
+            plot(first, y0 + gradient * (first - x0), first + 0.5f - x0);
+        if (last >= 0 && last < major_size)
+            plot(last, y0 + gradient * (last - x0), x1 - (last - 0.5f));
 
-        while (floor(pt[0]) <= floor(x1) && abs(pt[1] - y0) <= abs(y1 - y0)) {
-            rasterize_point(pt[0], pt[1], color);
-            pt[0] += dpt[0]; pt[1] += dpt[1];
+        // interior pixels, clipped to the framebuffer
+        long long k0 = max(first + 1, 0LL), k1 = min(last - 1, major_size - 1);
+        for (long long x = k0; x <= k1; ++x) {
+            plot(x, y0 + gradient * (x - x0), 1);
         }
     }
 
+    void RasterizerImp::rasterize_stroke(const Vector2f* points, size_t n, bool closed,
+                                         float width, const Style& style) {
+        Color color = style.strokeColor;
+
+        // A translucent stroke is composited once where its segments, joins
+        // and caps overlap. Smooth hairlines are left alone: Wu's endpoint
+        // weights already share the joint pixels between the segments.
+        bool once = color.a < 1 && stroke_mode != S_SMOOTH_HAIRLINE;
+        if (once) {
+            current_stroke = ++stroke_ids;
+            if (current_stroke == 0) current_stroke = ++stroke_ids;
+            if (!recording()) begin_stroke(current_stroke);
+        }
+
+        if (stroke_mode != S_TESSELLATED) {
+            // hairline, whatever the width
+            size_t segments = closed ? n : (n > 0 ? n - 1 : 0);
+            for (size_t i = 0; i < segments; i++) {
+                const Vector2f& p0 = points[i];
+                const Vector2f& p1 = points[(i + 1) % n];
+                rasterize_line(p0.x, p0.y, p1.x, p1.y, color);
+            }
+        } else {
+            stroke_triangles.clear();
+            {
+                STATS_TIME(TRIANGULATE);
+                stroke_polyline(points, n, closed, width, style, stroke_triangles);
+            }
+
+            const Vector2f* t = stroke_triangles.data();
+            for (size_t i = 0; i < stroke_triangles.size(); i += 3) {
+                rasterize_triangle(t[i].x, t[i].y, t[i+1].x, t[i+1].y, t[i+2].x, t[i+2].y, color);
+            }
+        }
+
+        if (once) {
+            current_stroke = 0;
+            begin_stroke(0);
+        }
+    }
+
+    // Clamps the sample space bounding box [xmin, xmax) x [ymin, ymax) of a
+    // triangle to the clip rectangle, normally the whole sample buffer.
+    // Returns false if nothing is left.
+    static inline bool clamp_bounds(float xmin, float xmax, float ymin, float ymax,
+                                    const IntRect& clip, int& x0, int& x1, int& y0, int& y1) {
+        if (!(xmin < clip.x1 && ymin < clip.y1 && xmax > clip.x0 && ymax > clip.y0)) return false;
+        x0 = (int)max(xmin, (float)clip.x0); x1 = (int)min(xmax, (float)clip.x1);
+        y0 = (int)max(ymin, (float)clip.y0); y1 = (int)min(ymax, (float)clip.y1);
+        return x0 < x1 && y0 < y1;
+    }
+
+    // Clips the polygon poly (n vertices, x y pairs) to one side of an axis
+    // aligned line: coordinate axis of each kept point is <= bound if upper,
+    // >= bound otherwise. Writes the result to out and returns its size.
+    static int clip_polygon(const float* poly, int n, int axis, float bound, bool upper, float* out) {
+        int m = 0;
+        for (int i = 0; i < n; ++i) {
+            const float* a = poly + 2 * i;
+            const float* b = poly + 2 * ((i + 1) % n);
+            float da = upper ? bound - a[axis] : a[axis] - bound;
+            float db = upper ? bound - b[axis] : b[axis] - bound;
+            if (da >= 0) { out[2 * m] = a[0]; out[2 * m + 1] = a[1]; ++m; }
+            if ((da >= 0) != (db >= 0)) {
+                float t = da / (da - db);
+                out[2 * m] = a[0] + t * (b[0] - a[0]);
+                out[2 * m + 1] = a[1] + t * (b[1] - a[1]);
+                out[2 * m + axis] = bound;
+                ++m;
+            }
+        }
+        return m;
+    }
+
     // Rasterize a triangle.
+    // Triangles reaching further than kGuardBand pixels outside the
+    // framebuffer are clipped to that guard band first, since the float edge
+    // functions lose precision with vertices far away. Anything closer is
+    // only limited by clamping its bounding box to the framebuffer.
     void RasterizerImp::rasterize_triangle(float x0, float y0,
                                            float x1, float y1,
                                            float x2, float y2,
                                            Color color) {
+        if (!replaying) STATS_ADD(primitives[RenderStats::TRIANGLES], 1);
+        if (color.a <= 0) return;
+        if (recording()) {
+            record({ DrawCommand::TRIANGLE, { x0, y0, x1, y1, x2, y2 }, { color } });
+            return;
+        }
+        bool blend = color.a < 1;
+
+        float gx0 = -kGuardBand, gy0 = -kGuardBand;
+        float gx1 = width + kGuardBand, gy1 = height + kGuardBand;
+        int c0 = outcode(x0, y0, gx0, gy0, gx1, gy1);
+        int c1 = outcode(x1, y1, gx0, gy0, gx1, gy1);
+        int c2 = outcode(x2, y2, gx0, gy0, gx1, gy1);
+        if (!(c0 | c1 | c2)) {
+            if (blend) fill_triangle<true>(x0, y0, x1, y1, x2, y2, color);
+            else       fill_triangle<false>(x0, y0, x1, y1, x2, y2, color);
+            return;
+        }
+        if (c0 & c1 & c2) return;
+
+        // each clip plane adds at most one vertex
+        float a[14] = { x0, y0, x1, y1, x2, y2 }, b[14];
+        int n = 3;
+        n = clip_polygon(a, n, 0, gx0, false, b);
+        n = clip_polygon(b, n, 0, gx1, true, a);
+        n = clip_polygon(a, n, 1, gy0, false, b);
+        n = clip_polygon(b, n, 1, gy1, true, a);
+
+        // filled as one convex polygon, since splitting it into triangles
+        // could leave cracks along the splits
+        if (blend) fill_convex_polygon<true>(a, n, color);
+        else       fill_convex_polygon<false>(a, n, color);
+    }
+
+    template <bool BLEND>
+    void RasterizerImp::fill_convex_polygon(const float* poly, int n, Color color) {
+        if (n < 3) return;
+        int rate = sqrt(sample_rate);
+
+        float p[14];
+        float xmin = INFINITY, xmax = -INFINITY, ymin = INFINITY, ymax = -INFINITY;
+        for (int i = 0; i < n; ++i) {
+            p[2 * i] = poly[2 * i] * rate;
+            p[2 * i + 1] = poly[2 * i + 1] * rate;
+            xmin = min(xmin, p[2 * i]); xmax = max(xmax, p[2 * i]);
+            ymin = min(ymin, p[2 * i + 1]); ymax = max(ymax, p[2 * i + 1]);
+        }
+
+        int sx0, sx1, sy0, sy1;
+        if (!clamp_bounds(floor(xmin), ceil(xmax), floor(ymin), ceil(ymax),
+                          scissor, sx0, sx1, sy0, sy1)) return;
+
+        size_t written = 0;
+        for (int x = sx0; x < sx1; x++) {
+            for (int y = sy0; y < sy1; y++) {
+                // inside if on the same side of every edge
+                int pos = 0, neg = 0;
+                for (int i = 0; i < n; ++i) {
+                    const float* a = p + 2 * i;
+                    const float* b = p + 2 * ((i + 1) % n);
+                    float l = lineEquation(x+0.5, y+0.5, a[0], a[1], b[0], b[1]);
+                    pos += l > 0.0; neg += l < 0.0;
+                }
+                if (pos == n || neg == n) {
+                    write_sample<BLEND>(sample_index(x, y, rate), color);
+                    ++written;
+                }
+            }
+        }
+        STATS_ADD(samples_tested, (size_t)(sx1 - sx0) * (sy1 - sy0));
+        STATS_ADD(samples_written, written);
+    }
+
+    template <bool BLEND>
+    void RasterizerImp::fill_triangle(float x0, float y0,
+                                      float x1, float y1,
+                                      float x2, float y2,
+                                      Color color) {
         float xmin, xmax, ymin, ymax;
         int rate = sqrt(sample_rate);
         // scale the triangle
@@ -83,25 +501,46 @@ namespace CGL {
         ymin = floor(min({y0, y1, y2}));
         ymax = ceil(max({y0, y1, y2}));
 
+        int sx0, sx1, sy0, sy1;
+        if (!clamp_bounds(xmin, xmax, ymin, ymax, scissor, sx0, sx1, sy0, sy1)) return;
+
         // Use the line equation for each sample
-        for (int x = xmin; x < xmax; x++) {
-            for (int y = ymin; y < ymax; y++) {
-                if (x < 0 || y < 0 || x >= width * rate || y >= height * rate) continue; // bound check
+        size_t written = 0;
+        for (int x = sx0; x < sx1; x++) {
+            for (int y = sy0; y < sy1; y++) {
                 float l0 = lineEquation(x+0.5, y+0.5, x0, y0, x1, y1);
                 float l1 = lineEquation(x+0.5, y+0.5, x1, y1, x2, y2);
                 float l2 = lineEquation(x+0.5, y+0.5, x2, y2, x0, y0);
                 // If the line equation result is + for all lines or - for all lines, then we know that the
                 // sample point is inside (bounded by) a triangle
                 if (l0 > 0.0 && l1 > 0.0 && l2 > 0.0 || l0 < 0.0 && l1 < 0.0 && l2 < 0.0)
-                    { sample_buffer[y * width * rate + x] = color; }
+                    { write_sample<BLEND>(sample_index(x, y, rate), color); ++written; }
             }
         }
+        STATS_ADD(samples_tested, (size_t)(sx1 - sx0) * (sy1 - sy0));
+        STATS_ADD(samples_written, written);
         return;
     }
 
     void RasterizerImp::rasterize_interpolated_color_triangle(float x0, float y0, Color c0,
                                                               float x1, float y1, Color c1,
                                                               float x2, float y2, Color c2)
+    {
+        if (!replaying) STATS_ADD(primitives[RenderStats::INTERPOLATED], 1);
+        if (recording()) {
+            record({ DrawCommand::INTERPOLATED, { x0, y0, x1, y1, x2, y2 }, { c0, c1, c2 } });
+            return;
+        }
+        if (c0.a < 1 || c1.a < 1 || c2.a < 1)
+            interpolated_color_triangle<true>(x0, y0, c0, x1, y1, c1, x2, y2, c2);
+        else
+            interpolated_color_triangle<false>(x0, y0, c0, x1, y1, c1, x2, y2, c2);
+    }
+
+    template <bool BLEND>
+    void RasterizerImp::interpolated_color_triangle(float x0, float y0, Color c0,
+                                                    float x1, float y1, Color c1,
+                                                    float x2, float y2, Color c2)
     {
         float xmin, xmax, ymin, ymax;
         float bCoords[3];
@@ -121,19 +560,26 @@ namespace CGL {
         ymin = floor(min({y0, y1, y2}));
         ymax = ceil(max({y0, y1, y2}));
 
-        for (int x = xmin; x < xmax; x++) {
-            for (int y = ymin; y < ymax; y++) {
-                if (x < 0 || y < 0 || x >= width * rate || y >= height * rate) continue; // bound check
+        int sx0, sx1, sy0, sy1;
+        if (!clamp_bounds(xmin, xmax, ymin, ymax, scissor, sx0, sx1, sy0, sy1)) return;
+
+        size_t written = 0;
+        for (int x = sx0; x < sx1; x++) {
+            for (int y = sy0; y < sy1; y++) {
                 fill_n(bCoords, 3, 0);
                 barycentricCoord(x+0.5, y+0.5, x0, y0, x1, y1, x2, y2, bCoords);
                 float l0 = lineEquation(x+0.5, y+0.5, x0, y0, x1, y1);
                 float l1 = lineEquation(x+0.5, y+0.5, x1, y1, x2, y2);
                 float l2 = lineEquation(x+0.5, y+0.5, x2, y2, x0, y0);
                 if (l0 >= 0.0 && l1 >= 0.0 && l2 >= 0.0 || l0 <= 0.0 && l1 <= 0.0 && l2 <= 0.0) {
-                    sample_buffer[y * width * rate + x] = (bCoords[0] * c0) + (bCoords[1] * c1) + (bCoords[2] * c2);
+                    write_sample<BLEND>(sample_index(x, y, rate),
+                                        (bCoords[0] * c0) + (bCoords[1] * c1) + (bCoords[2] * c2));
+                    ++written;
                 }
             }
         }
+        STATS_ADD(samples_tested, (size_t)(sx1 - sx0) * (sy1 - sy0));
+        STATS_ADD(samples_written, written);
     }
 
     void RasterizerImp::rasterize_textured_triangle(float x0, float y0, float u0, float v0,
@@ -141,12 +587,27 @@ namespace CGL {
                                                     float x2, float y2, float u2, float v2,
                                                     Texture& tex)
     {
-        int rate = sqrt(sample_rate);
+        if (!replaying) STATS_ADD(primitives[RenderStats::TEXTURED], 1);
+        if (recording()) {
+            record({ DrawCommand::TEXTURED, { x0, y0, u0, v0, x1, y1, u1, v1, x2, y2, u2, v2 },
+                                 {}, &tex });
+            return;
+        }
+
+        // resolve the sampling modes once for the whole triangle
+        TexturedTriangleKernel kernel = select_textured_kernel();
+        (this->*kernel)(x0, y0, u0, v0, x1, y1, u1, v1, x2, y2, u2, v2, tex);
+    }
+
+    template <PixelSampleMethod P, LevelSampleMethod L, int RATE>
+    void RasterizerImp::textured_triangle_kernel(float x0, float y0, float u0, float v0,
+                                                 float x1, float y1, float u1, float v1,
+                                                 float x2, float y2, float u2, float v2,
+                                                 Texture& tex)
+    {
+        const int rate = RATE ? RATE : (int)sqrt(sample_rate);
         float xmin, xmax, ymin, ymax;
         float bCoords[3];
-        SampleParams sample;
-        sample.lsm = lsm;
-        sample.psm = psm;
 
         // scale the triangle
         x0 *= rate;
@@ -162,46 +623,601 @@ namespace CGL {
         ymin = floor(min({y0, y1, y2}));
         ymax = ceil(max({y0, y1, y2}));
 
-        for (int x = xmin; x < xmax; x++) {
-            for (int y = ymin; y < ymax; y++) {
-                if (x < 0 || y < 0 || x >= width * rate || y >= height * rate) continue; // bound check
-                fill_n(bCoords, 3, 0);
+        int sx0, sx1, sy0, sy1;
+        if (!clamp_bounds(xmin, xmax, ymin, ymax, scissor, sx0, sx1, sy0, sy1)) return;
 
-                barycentricCoord(x+0.5, y+0.5, x0, y0, x1, y1, x2, y2, bCoords);
-                sample.p_uv = Vector2D(u0, v0) * bCoords[0] + Vector2D(u1, v1) * bCoords[1] + Vector2D(u2, v2) * bCoords[2];
-                barycentricCoord(x+1.5, y+0.5, x0, y0, x1, y1, x2, y2, bCoords);
-                sample.p_dx_uv = Vector2D(u0, v0) * bCoords[0] + Vector2D(u1, v1) * bCoords[1] + Vector2D(u2, v2) * bCoords[2];
-                barycentricCoord(x+0.5, y+1.5, x0, y0, x1, y1, x2, y2, bCoords);
-                sample.p_dy_uv = Vector2D(u0, v0) * bCoords[0] + Vector2D(u1, v1) * bCoords[1] + Vector2D(u2, v2) * bCoords[2];
+        Vector2D uv0(u0, v0), uv1(u1, v1), uv2(u2, v2);
+
+        // uv is affine in screen space, so its derivatives, and with them the
+        // level of detail, are the same for every sample of the triangle
+        float level = 0;
+        AnisoFootprint footprint;
+        if (L != L_ZERO) {
+            SampleParams sp;
+            barycentricCoord(xmin + 0.5, ymin + 0.5, x0, y0, x1, y1, x2, y2, bCoords);
+            sp.p_uv = uv0 * bCoords[0] + uv1 * bCoords[1] + uv2 * bCoords[2];
+            barycentricCoord(xmin + 1.5, ymin + 0.5, x0, y0, x1, y1, x2, y2, bCoords);
+            sp.p_dx_uv = uv0 * bCoords[0] + uv1 * bCoords[1] + uv2 * bCoords[2];
+            barycentricCoord(xmin + 0.5, ymin + 1.5, x0, y0, x1, y1, x2, y2, bCoords);
+            sp.p_dy_uv = uv0 * bCoords[0] + uv1 * bCoords[1] + uv2 * bCoords[2];
 
+            if (L == L_ANISOTROPIC) {
+                footprint = tex.get_footprint(sp.p_dx_uv - sp.p_uv, sp.p_dy_uv - sp.p_uv, max_aniso);
+            } else {
+                // clamp degenerate footprints to the coarsest level
+                level = min(tex.get_level(sp), (float)(tex.mipmap.size() - 1));
+            }
+        }
+
+        size_t written = 0;
+        for (int y = sy0; y < sy1; y++) {
+            for (int x = sx0; x < sx1; x++) {
                 float l0 = lineEquation(x+0.5, y+0.5, x0, y0, x1, y1);
                 float l1 = lineEquation(x+0.5, y+0.5, x1, y1, x2, y2);
                 float l2 = lineEquation(x+0.5, y+0.5, x2, y2, x0, y0);
+                if (!(l0 >= 0.0 && l1 >= 0.0 && l2 >= 0.0 || l0 <= 0.0 && l1 <= 0.0 && l2 <= 0.0)) continue;
 
-                if (l0 >= 0.0 && l1 >= 0.0 && l2 >= 0.0 || l0 <= 0.0 && l1 <= 0.0 && l2 <= 0.0) {
-                        sample_buffer[y * width * sqrt(sample_rate) + x] = tex.sample(sample);
+                barycentricCoord(x+0.5, y+0.5, x0, y0, x1, y1, x2, y2, bCoords);
+                Vector2D uv = uv0 * bCoords[0] + uv1 * bCoords[1] + uv2 * bCoords[2];
+
+                sample_buffer[sample_index(x, y, rate)] = L == L_ANISOTROPIC
+                    ? tex.sample_aniso<P>(uv, footprint)
+                    : tex.sample_at<P, L>(uv, level);
+                ++written;
+            }
+        }
+        STATS_ADD(samples_tested, (size_t)(sx1 - sx0) * (sy1 - sy0));
+        STATS_ADD(samples_written, written);
+    }
+
+    template <PixelSampleMethod P, LevelSampleMethod L>
+    RasterizerImp::TexturedTriangleKernel RasterizerImp::textured_kernel_for_rate(unsigned int sample_rate) {
+        switch (sample_rate) {
+            case 1:  return &RasterizerImp::textured_triangle_kernel<P, L, 1>;
+            case 4:  return &RasterizerImp::textured_triangle_kernel<P, L, 2>;
+            case 9:  return &RasterizerImp::textured_triangle_kernel<P, L, 3>;
+            case 16: return &RasterizerImp::textured_triangle_kernel<P, L, 4>;
+            default: return &RasterizerImp::textured_triangle_kernel<P, L, 0>;
+        }
+    }
+
+    template <PixelSampleMethod P>
+    RasterizerImp::TexturedTriangleKernel RasterizerImp::textured_kernel_for_lsm(LevelSampleMethod lsm, unsigned int sample_rate) {
+        switch (lsm) {
+            case L_NEAREST:     return textured_kernel_for_rate<P, L_NEAREST>(sample_rate);
+            case L_LINEAR:      return textured_kernel_for_rate<P, L_LINEAR>(sample_rate);
+            case L_ANISOTROPIC: return textured_kernel_for_rate<P, L_ANISOTROPIC>(sample_rate);
+            default:            return textured_kernel_for_rate<P, L_ZERO>(sample_rate);
+        }
+    }
+
+    RasterizerImp::TexturedTriangleKernel RasterizerImp::select_textured_kernel() {
+        if (psm == P_LINEAR)
+            return textured_kernel_for_lsm<P_LINEAR>(lsm, sample_rate);
+        return textured_kernel_for_lsm<P_NEAREST>(lsm, sample_rate);
+    }
+
+    // Occlusion culling
+    //
+    // While culling, primitives are recorded rather than drawn. At resolve
+    // time a reverse pass over the opaque triangles marks, for each tile of
+    // samples, the last triangle that covers all of it. The primitives are
+    // then drawn in order, skipping every tile that a later opaque triangle
+    // is going to overwrite anyway, so the result is the same as drawing
+    // them all.
+
+    void RasterizerImp::reset_scissor() {
+        int rate = sqrt(sample_rate);
+        scissor = { 0, (int)width * rate, band_y0 * rate, band_y1 * rate };
+    }
+
+    // True if every sample center in r is inside the triangle v (three x y
+    // pairs in sample space), by enough of a margin that the float edge
+    // tests of the triangle kernels agree.
+    static bool covers_rect(const float* v, const IntRect& r) {
+        double area = ((double)v[2] - v[0]) * ((double)v[5] - v[1])
+                    - ((double)v[3] - v[1]) * ((double)v[4] - v[0]);
+        if (area == 0) return false;
+        double sign = area > 0 ? 1 : -1;
+
+        double cx[2] = { r.x0 + 0.5, r.x1 - 0.5 };
+        double cy[2] = { r.y0 + 0.5, r.y1 - 0.5 };
+        for (int e = 0; e < 3; ++e) {
+            double ax = v[2 * e], ay = v[2 * e + 1];
+            double bx = v[2 * ((e + 1) % 3)], by = v[2 * ((e + 1) % 3) + 1];
+            // the edge function is linear, so it is smallest at a corner,
+            // and its rounding error is bounded by the size of its terms
+            for (int i = 0; i < 2; ++i) {
+                for (int j = 0; j < 2; ++j) {
+                    double l = -(cx[i] - ax) * (by - ay) + (cy[j] - ay) * (bx - ax);
+                    double mag = abs(cx[i] - ax) * abs(by - ay) + abs(cy[j] - ay) * abs(bx - ax);
+                    if (!(l * sign > 1e-5 * mag)) return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool RasterizerImp::command_bounds(const DrawCommand& cmd, IntRect& r) const {
+        int rate = sqrt(sample_rate);
+        IntRect buffer = { 0, (int)width * rate, band_y0 * rate, band_y1 * rate };
+        return command_bounds(cmd, buffer, r);
+    }
+
+    bool RasterizerImp::command_bounds(const DrawCommand& cmd, const IntRect& clip, IntRect& r) const {
+        int rate = sqrt(sample_rate);
+        const float* v = cmd.v;
+        float xmin, xmax, ymin, ymax;
+        switch (cmd.type) {
+            case DrawCommand::POINT:
+                xmin = floor(v[0]); xmax = xmin + 1;
+                ymin = floor(v[1]); ymax = ymin + 1;
+                break;
+            case DrawCommand::LINE:
+                // lines may touch the pixels just beyond their endpoints
+                xmin = floor(min(v[0], v[2])) - 1; xmax = floor(max(v[0], v[2])) + 2;
+                ymin = floor(min(v[1], v[3])) - 1; ymax = floor(max(v[1], v[3])) + 2;
+                break;
+            case DrawCommand::TEXTURED:
+                xmin = floor(min({v[0], v[4], v[8]}));  xmax = ceil(max({v[0], v[4], v[8]}));
+                ymin = floor(min({v[1], v[5], v[9]}));  ymax = ceil(max({v[1], v[5], v[9]}));
+                break;
+            default:
+                xmin = floor(min({v[0], v[2], v[4]}));  xmax = ceil(max({v[0], v[2], v[4]}));
+                ymin = floor(min({v[1], v[3], v[5]}));  ymax = ceil(max({v[1], v[3], v[5]}));
+                break;
+        }
+        return clamp_bounds(floor(xmin * rate), ceil(xmax * rate), floor(ymin * rate), ceil(ymax * rate),
+                            clip, r.x0, r.x1, r.y0, r.y1);
+    }
+
+    bool RasterizerImp::tiles_hidden(int tx0, int tx1, int ty0, int ty1, int index) const {
+        for (int by = ty0 / kBlockTiles; by <= (ty1 - 1) / kBlockTiles; ++by) {
+            for (int bx = tx0 / kBlockTiles; bx <= (tx1 - 1) / kBlockTiles; ++bx) {
+                if (block_owner[by * blocks_w + bx] > index) continue;
+                // the block as a whole is not hidden, check its tiles
+                int x0 = max(tx0, bx * kBlockTiles), x1 = min(tx1, (bx + 1) * kBlockTiles);
+                int y0 = max(ty0, by * kBlockTiles), y1 = min(ty1, (by + 1) * kBlockTiles);
+                for (int ty = y0; ty < y1; ++ty) {
+                    for (int tx = x0; tx < x1; ++tx) {
+                        if (tile_owner[ty * tiles_w + tx] <= index) return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    void RasterizerImp::mark_covered_tiles(const DrawCommand& cmd, int index, const IntRect& r) {
+        int rate = sqrt(sample_rate);
+        const float* v = cmd.v;
+        float t[6];
+        if (cmd.type == DrawCommand::TEXTURED) {
+            for (int k = 0; k < 3; ++k) { t[2 * k] = v[4 * k] * rate; t[2 * k + 1] = v[4 * k + 1] * rate; }
+        } else {
+            for (int k = 0; k < 6; ++k) t[k] = v[k] * rate;
+        }
+
+        // tiles start at the top of the band
+        int ssw = width * rate, oy = band_y0 * rate, ssh = band_y1 * rate;
+        int tx0 = r.x0 / kTileSize, tx1 = (r.x1 - 1) / kTileSize + 1;
+        int ty0 = (r.y0 - oy) / kTileSize, ty1 = (r.y1 - oy - 1) / kTileSize + 1;
+        bool marked = false;
+        for (int ty = ty0; ty < ty1; ++ty) {
+            for (int tx = tx0; tx < tx1; ++tx) {
+                int& owner = tile_owner[ty * tiles_w + tx];
+                if (owner >= 0) continue;
+                IntRect tile = { tx * kTileSize, min((tx + 1) * kTileSize, ssw),
+                                 oy + ty * kTileSize, min(oy + (ty + 1) * kTileSize, ssh) };
+                if (covers_rect(t, tile)) { owner = index; marked = true; }
+            }
+        }
+        if (!marked) return;
+
+        // refresh the minimum of the blocks touched
+        for (int by = ty0 / kBlockTiles; by <= (ty1 - 1) / kBlockTiles; ++by) {
+            for (int bx = tx0 / kBlockTiles; bx <= (tx1 - 1) / kBlockTiles; ++bx) {
+                int m = INT_MAX;
+                for (int ty = by * kBlockTiles; ty < min((by + 1) * kBlockTiles, tiles_h); ++ty) {
+                    for (int tx = bx * kBlockTiles; tx < min((bx + 1) * kBlockTiles, tiles_w); ++tx) {
+                        m = min(m, tile_owner[ty * tiles_w + tx]);
+                    }
+                }
+                block_owner[by * blocks_w + bx] = m;
+            }
+        }
+    }
+
+    void RasterizerImp::draw_command(const DrawCommand& cmd) {
+        if (cmd.stroke != drawn_stroke) begin_stroke(cmd.stroke);
+        const float* v = cmd.v;
+        switch (cmd.type) {
+            case DrawCommand::POINT:
+                rasterize_point(v[0], v[1], cmd.c[0]);
+                break;
+            case DrawCommand::LINE:
+                rasterize_line(v[0], v[1], v[2], v[3], cmd.c[0]);
+                break;
+            case DrawCommand::TRIANGLE:
+                rasterize_triangle(v[0], v[1], v[2], v[3], v[4], v[5], cmd.c[0]);
+                break;
+            case DrawCommand::INTERPOLATED:
+                rasterize_interpolated_color_triangle(v[0], v[1], cmd.c[0], v[2], v[3], cmd.c[1],
+                                                      v[4], v[5], cmd.c[2]);
+                break;
+            case DrawCommand::TEXTURED:
+                rasterize_textured_triangle(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7],
+                                            v[8], v[9], v[10], v[11], *cmd.tex);
+                break;
+        }
+    }
+
+    void RasterizerImp::draw_commands() {
+        STATS_TIME(RASTERIZE);
+
+        // the commands that may touch a band, or all of them
+        vector<int> band;
+        bool banded = band_y0 > 0 || band_y1 < (int)height;
+        if (banded) {
+            if (!row_index_valid) build_row_index();
+            for (int cy = band_y0 / kIndexCell; cy <= (band_y1 - 1) / kIndexCell; ++cy) {
+                const vector<int>& cell = row_index[cy];
+                band.insert(band.end(), cell.begin(), cell.end());
+            }
+            if (band_y0 / kIndexCell != (band_y1 - 1) / kIndexCell) {
+                sort(band.begin(), band.end());
+                band.erase(unique(band.begin(), band.end()), band.end());
+            }
+        }
+        int n = banded ? band.size() : commands.size();
+        auto command = [&](int k) -> const DrawCommand& { return commands[banded ? band[k] : k]; };
+
+        if (!occlusion_culling) {
+            // only retained, draw everything in order
+            replaying = true;
+            for (int k = 0; k < n; ++k) {
+                if (cancelled()) break;
+                draw_command(command(k));
+            }
+            replaying = false;
+            begin_stroke(0);
+            commands_pending = false;
+            return;
+        }
+
+        // tiles start at the top of the band
+        int rate = sqrt(sample_rate);
+        int ssw = width * rate, oy = band_y0 * rate, ssh = band_y1 * rate;
+        tiles_w = (ssw + kTileSize - 1) / kTileSize;
+        tiles_h = (ssh - oy + kTileSize - 1) / kTileSize;
+        blocks_w = (tiles_w + kBlockTiles - 1) / kBlockTiles;
+        blocks_h = (tiles_h + kBlockTiles - 1) / kBlockTiles;
+        tile_owner.assign(tiles_w * tiles_h, -1);
+        block_owner.assign(blocks_w * blocks_h, -1);
+
+        // commands are numbered from 0 to n - 1 in drawing order
+        vector<IntRect> bounds(n);
+        vector<char> visible(n);
+        for (int i = 0; i < n; ++i) visible[i] = command_bounds(command(i), bounds[i]);
+
+        // front to back over the opaque triangles; those already hidden
+        // cannot cover anything new
+        for (int i = n - 1; i >= 0; --i) {
+            if (cancelled()) return;
+            const DrawCommand& cmd = command(i);
+            if (!visible[i]) continue;
+            bool opaque = cmd.type == DrawCommand::TEXTURED
+                || cmd.type == DrawCommand::TRIANGLE && cmd.c[0].a >= 1
+                || cmd.type == DrawCommand::INTERPOLATED
+                   && cmd.c[0].a >= 1 && cmd.c[1].a >= 1 && cmd.c[2].a >= 1;
+            if (!opaque) continue;
+            // flat triangles past the guard band are filled as clipped polygons
+            if (cmd.type == DrawCommand::TRIANGLE) {
+                const float* v = cmd.v;
+                float g0 = -kGuardBand, gx1 = width + kGuardBand, gy1 = height + kGuardBand;
+                if (outcode(v[0], v[1], g0, g0, gx1, gy1) | outcode(v[2], v[3], g0, g0, gx1, gy1)
+                    | outcode(v[4], v[5], g0, g0, gx1, gy1)) continue;
+            }
+            const IntRect& r = bounds[i];
+            if (tiles_hidden(r.x0 / kTileSize, (r.x1 - 1) / kTileSize + 1,
+                             (r.y0 - oy) / kTileSize, (r.y1 - oy - 1) / kTileSize + 1, i)) continue;
+            mark_covered_tiles(cmd, i, r);
+        }
+
+        // in order, drawing only the tiles nothing later covers
+        replaying = true;
+        for (int i = 0; i < n; ++i) {
+            if (cancelled()) break;
+            if (!visible[i]) continue;
+            const DrawCommand& cmd = command(i);
+            const IntRect& r = bounds[i];
+            int tx0 = r.x0 / kTileSize, tx1 = (r.x1 - 1) / kTileSize + 1;
+            int ty0 = (r.y0 - oy) / kTileSize, ty1 = (r.y1 - oy - 1) / kTileSize + 1;
+            if (tiles_hidden(tx0, tx1, ty0, ty1, i)) {
+                STATS_ADD(culled, 1);
+                continue;
+            }
+
+            // points and lines write whole pixels and are drawn entirely
+            if (cmd.type == DrawCommand::POINT || cmd.type == DrawCommand::LINE) {
+                draw_command(cmd);
+                continue;
+            }
+
+            bool partly_hidden = false;
+            for (int ty = ty0; ty < ty1 && !partly_hidden; ++ty) {
+                for (int tx = tx0; tx < tx1; ++tx) {
+                    if (tile_owner[ty * tiles_w + tx] > i) { partly_hidden = true; break; }
+                }
+            }
+            if (!partly_hidden) {
+                draw_command(cmd);
+                continue;
+            }
+
+            // draw each run of visible tiles in a row through the scissor
+            for (int ty = ty0; ty < ty1; ++ty) {
+                for (int tx = tx0; tx < tx1; ) {
+                    if (tile_owner[ty * tiles_w + tx] > i) { ++tx; continue; }
+                    int end = tx + 1;
+                    while (end < tx1 && tile_owner[ty * tiles_w + end] <= i) ++end;
+                    scissor = { tx * kTileSize, min(end * kTileSize, ssw),
+                                oy + ty * kTileSize, min(oy + (ty + 1) * kTileSize, ssh) };
+                    draw_command(cmd);
+                    tx = end;
+                }
+            }
+            reset_scissor();
+        }
+        replaying = false;
+        begin_stroke(0);
+        commands_pending = false;
+        if (!retained) commands.clear();
+    }
+
+    // Retained mode
+
+    void RasterizerImp::record(DrawCommand cmd) {
+        cmd.tag = current_tag;
+        cmd.stroke = current_stroke;
+        if (updating) {
+            update_commands.push_back(cmd);
+        } else {
+            commands.push_back(cmd);
+            commands_pending = true;
+        }
+        index_valid = row_index_valid = false;
+    }
+
+    bool RasterizerImp::commands_pixel_bounds(const DrawCommand* first, const DrawCommand* last,
+                                              IntRect& r) const {
+        int rate = sqrt(sample_rate);
+        bool any = false;
+        for (const DrawCommand* cmd = first; cmd != last; ++cmd) {
+            IntRect b;
+            if (!command_bounds(*cmd, b)) continue;
+            // samples to the pixels containing them
+            b = { b.x0 / rate, (b.x1 + rate - 1) / rate, b.y0 / rate, (b.y1 + rate - 1) / rate };
+            if (!any) r = b;
+            r = { min(r.x0, b.x0), max(r.x1, b.x1), min(r.y0, b.y0), max(r.y1, b.y1) };
+            any = true;
+        }
+        return any;
+    }
+
+    void RasterizerImp::begin_update(int tag) {
+        updating = true;
+        current_tag = tag;
+        update_commands.clear();
+    }
+
+    bool RasterizerImp::end_update(IntRect& dirty) {
+        updating = false;
+
+        // commands are recorded in tag order, so the old ones are a range
+        int tag = current_tag;
+        auto first = lower_bound(commands.begin(), commands.end(), tag,
+                                 [](const DrawCommand& c, int t) { return c.tag < t; });
+        auto last = upper_bound(first, commands.end(), tag,
+                                [](int t, const DrawCommand& c) { return t < c.tag; });
+
+        IntRect before, after;
+        const DrawCommand* base = commands.data();
+        bool had = commands_pixel_bounds(base + (first - commands.begin()),
+                                         base + (last - commands.begin()), before);
+        bool has = commands_pixel_bounds(update_commands.data(),
+                                         update_commands.data() + update_commands.size(), after);
+        if (had && has) {
+            dirty = { min(before.x0, after.x0), max(before.x1, after.x1),
+                      min(before.y0, after.y0), max(before.y1, after.y1) };
+        } else if (had || has) {
+            dirty = had ? before : after;
+        }
+
+        size_t at = first - commands.begin();
+        commands.erase(first, last);
+        commands.insert(commands.begin() + at, update_commands.begin(), update_commands.end());
+        update_commands.clear();
+        index_valid = row_index_valid = false;
+        return had || has;
+    }
+
+    // Moves the w x h image in buf, n values per pixel, by (dx, dy) pixels,
+    // filling the pixels nothing moves into with fill
+    template <typename T>
+    static void shift_image(T* buf, int w, int h, int n, int dx, int dy, T fill_value) {
+        int cols = w - abs(dx);
+        int src_x = max(-dx, 0), dst_x = max(dx, 0);
+        size_t stride = (size_t)w * n;
+        for (int i = 0; i < h; ++i) {
+            // rows are visited so that none is overwritten before it is read
+            int y = dy > 0 ? h - 1 - i : i;
+            int sy = y - dy;
+            T* dst = buf + y * stride;
+            if (sy < 0 || sy >= h) {
+                fill(dst, dst + stride, fill_value);
+                continue;
+            }
+            memmove(dst + dst_x * n, buf + sy * stride + src_x * n, cols * n * sizeof(T));
+            int gap = dx > 0 ? 0 : cols;
+            fill(dst + gap * n, dst + (gap + abs(dx)) * n, fill_value);
+        }
+    }
+
+    bool RasterizerImp::scroll(int dx, int dy) {
+        if (!retained || abs(dx) >= (int)width || abs(dy) >= (int)height) return false;
+        if (band_y0 > 0 || band_y1 < (int)height) return false;
+
+        int rate = sqrt(sample_rate);
+        shift_image(sample_buffer.data(), width * rate, height * rate, 1, dx * rate, dy * rate, Color::White);
+        shift_image(rgb_framebuffer_target, width, height, 3, dx, dy, (unsigned char)255);
+
+        // the columns, then the rest of the rows, uncovered by the move
+        int w = width, h = height;
+        exposed.clear();
+        if (dx) {
+            exposed.push_back(dx > 0 ? IntRect{ 0, dx, 0, h } : IntRect{ w + dx, w, 0, h });
+        }
+        if (dy) {
+            int x0 = max(dx, 0), x1 = w + min(dx, 0);
+            exposed.push_back(dy > 0 ? IntRect{ x0, x1, 0, dy } : IntRect{ x0, x1, h + dy, h });
+        }
+
+        // the display list is recorded again for the new view
+        commands.clear();
+        commands_pending = false;
+        index_valid = row_index_valid = false;
+        return true;
+    }
+
+    void RasterizerImp::build_index() {
+        int rate = sqrt(sample_rate);
+        index_w = (width + kIndexCell - 1) / kIndexCell;
+        index_h = (height + kIndexCell - 1) / kIndexCell;
+        index.assign(index_w * index_h, vector<int>());
+        for (size_t i = 0; i < commands.size(); ++i) {
+            IntRect b;
+            if (!command_bounds(commands[i], b)) continue;
+            int cx0 = b.x0 / rate / kIndexCell, cx1 = (b.x1 - 1) / rate / kIndexCell;
+            int cy0 = b.y0 / rate / kIndexCell, cy1 = (b.y1 - 1) / rate / kIndexCell;
+            for (int cy = cy0; cy <= cy1; ++cy) {
+                for (int cx = cx0; cx <= cx1; ++cx) {
+                    index[cy * index_w + cx].push_back(i);
                 }
             }
         }
+        index_valid = true;
+    }
+
+    void RasterizerImp::build_row_index() {
+        int rate = sqrt(sample_rate);
+        IntRect frame = { 0, (int)width * rate, 0, (int)height * rate };
+        row_index.assign((height + kIndexCell - 1) / kIndexCell, vector<int>());
+        for (size_t i = 0; i < commands.size(); ++i) {
+            IntRect b;
+            if (!command_bounds(commands[i], frame, b)) continue;
+            for (int cy = b.y0 / rate / kIndexCell; cy <= (b.y1 - 1) / rate / kIndexCell; ++cy) {
+                row_index[cy].push_back(i);
+            }
+        }
+        row_index_valid = true;
+    }
+
+    void RasterizerImp::redraw_region(const IntRect& rect) {
+        IntRect r = { max(rect.x0, 0), min(rect.x1, (int)width),
+                      max(rect.y0, band_y0), min(rect.y1, band_y1) };
+        if (r.x0 >= r.x1 || r.y0 >= r.y1) return;
+        if (!index_valid) build_index();
+
+        int rate = sqrt(sample_rate);
+        scissor = { r.x0 * rate, r.x1 * rate, r.y0 * rate, r.y1 * rate };
+        for (int y = scissor.y0; y < scissor.y1; ++y) {
+            fill(&sample_buffer[sample_index(scissor.x0, y, rate)],
+                 &sample_buffer[sample_index(scissor.x1, y, rate)], Color::White);
+        }
+
+        // commands overlapping the region, in drawing order
+        vector<int> hits;
+        for (int cy = r.y0 / kIndexCell; cy <= (r.y1 - 1) / kIndexCell; ++cy) {
+            for (int cx = r.x0 / kIndexCell; cx <= (r.x1 - 1) / kIndexCell; ++cx) {
+                const vector<int>& cell = index[cy * index_w + cx];
+                hits.insert(hits.end(), cell.begin(), cell.end());
+            }
+        }
+        sort(hits.begin(), hits.end());
+        hits.erase(unique(hits.begin(), hits.end()), hits.end());
+
+        {
+            STATS_TIME(RASTERIZE);
+            replaying = true;
+            for (int i : hits) {
+                if (cancelled()) break;
+                draw_command(commands[i]);
+            }
+            replaying = false;
+            begin_stroke(0);
+            reset_scissor();
+        }
+
+        resolve_region(r);
+    }
+
+    void RasterizerImp::resize_sample_buffer() {
+        this->sample_buffer.resize(width * (band_y1 - band_y0) * sample_rate, Color::White);
+        reset_scissor();
     }
 
     void RasterizerImp::set_sample_rate(unsigned int rate) {
         this->sample_rate = rate;
-        this->sample_buffer.resize(width * height * sample_rate, Color::White);
+        resize_sample_buffer();
+        index_valid = row_index_valid = false;
     }
 
     void RasterizerImp::set_framebuffer_target(unsigned char* rgb_framebuffer,
                                                size_t width, size_t height)
     {
+        // the bands of a frame share its display list, a new frame size
+        // does not
+        if (width != this->width || height != this->height) row_index_valid = false;
         this->width = width;
         this->height = height;
+        this->band_y0 = 0;
+        this->band_y1 = height;
         this->rgb_framebuffer_target = rgb_framebuffer;
-        this->sample_buffer.resize(width * height * sample_rate, Color::White);
+        resize_sample_buffer();
+        index_valid = false;
+    }
+
+    void RasterizerImp::set_band_target(unsigned char* rgb_band,
+                                        size_t width, size_t height, int y0, int y1)
+    {
+        if (width != this->width || height != this->height) row_index_valid = false;
+        this->width = width;
+        this->height = height;
+        this->band_y0 = max(y0, 0);
+        this->band_y1 = max(band_y0, min(y1, (int)height));
+        this->rgb_framebuffer_target = rgb_band;
+
+        // the shrunk buffer is not released, bands are drawn one after another
+        resize_sample_buffer();
+        std::fill(sample_buffer.begin(), sample_buffer.end(), Color::White);
+        index_valid = false;
+        exposed.clear();
+        commands_pending = retained && !commands.empty();
     }
 
     void RasterizerImp::clear_buffers() {
-        std::fill(rgb_framebuffer_target, rgb_framebuffer_target + 3 * width * height, 255);
+        std::fill(rgb_framebuffer_target, rgb_framebuffer_target + 3 * width * (band_y1 - band_y0), 255);
         std::fill(sample_buffer.begin(), sample_buffer.end(), Color::White);
+        commands.clear();
+        commands_pending = false;
+        index_valid = row_index_valid = false;
+        exposed.clear();
+    }
+
+    void RasterizerImp::draw_pending() {
+        // after a scroll the exposed pixels are drawn as they are resolved
+        if (exposed.empty() && commands_pending) draw_commands();
     }
 
     // This function is called at the end of rasterizing all elements of the
@@ -210,12 +1226,28 @@ namespace CGL {
     // pixels from the supersample buffer data.
     //
     void RasterizerImp::resolve_to_framebuffer() {
-        for (int x = 0; x < width; ++x) {
-            for (int y = 0; y < height; ++y) {
+        if (!exposed.empty()) {
+            // after a scroll, only the exposed pixels are drawn
+            commands_pending = false;
+            vector<IntRect> rects;
+            rects.swap(exposed);
+            for (const IntRect& r : rects) redraw_region(r);
+            return;
+        }
+        if (commands_pending) draw_commands();
+        resolve_region({ 0, (int)width, band_y0, band_y1 });
+    }
+
+    // Resolves the pixels in r only
+    void RasterizerImp::resolve_region(const IntRect& r) {
+        STATS_TIME(RESOLVE);
+        for (int x = r.x0; x < r.x1; ++x) {
+            if (cancelled()) return;
+            for (int y = r.y0; y < r.y1; ++y) {
                 Color col = averagePixels(x, y);
                 for (int k = 0; k < 3; ++k) {
                     // Add each (weighted) supersample to the pixel it belongs to
-                    this->rgb_framebuffer_target[3 * (y * width + x) + k] = (&col.r)[k] * 255;
+                    this->rgb_framebuffer_target[3 * ((y - band_y0) * width + x) + k] = (&col.r)[k] * 255;
                 }
             }
         }
@@ -224,8 +1256,9 @@ namespace CGL {
     // This function returns a color that is the average of the supersamples for the pixel (x,y)
     // The sample_buffer is in row order
     Color RasterizerImp::averagePixels(int x, int y){
-        int start = y * width * sample_rate + x * sqrt(sample_rate);
-        Color color = Color();
+        int rate = sqrt(sample_rate);
+        size_t start = sample_index(x * rate, y * rate, rate);
+        Color color = Color(0, 0, 0, 0);
         for (int col = 0; col < sqrt(sample_rate); ++col) {
             for (int row = 0; row < sqrt(sample_rate); ++row) {
                 color += sample_buffer[start + row * sqrt(sample_rate) * width + col] * (1.0 / sample_rate);
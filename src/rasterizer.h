@@ -4,10 +4,23 @@
 #include "CGL/color.h"
 #include "CGL/vector3D.h"
 #include <vector>
+#include <atomic>
 #include "svg.h"
 
 namespace CGL {
 
+  // How lines and strokes are drawn
+  enum StrokeMode {
+    S_HAIRLINE = 0,        // one pixel wide lines
+    S_SMOOTH_HAIRLINE = 1, // one pixel wide lines with coverage antialiasing
+    S_TESSELLATED = 2      // strokes at their full width, as triangles
+  };
+
+  // A rectangle of pixels or samples, [x0, x1) x [y0, y1)
+  struct IntRect {
+    int x0, x1, y0, y1;
+  };
+
   class Rasterizer {
   public:
     virtual ~Rasterizer() = 0;
@@ -16,6 +29,44 @@ namespace CGL {
     virtual void set_sample_rate(unsigned int rate) = 0;
     virtual void set_psm(PixelSampleMethod p) = 0;
     virtual void set_lsm(LevelSampleMethod l) = 0;
+    virtual void set_max_anisotropy(unsigned int ratio) = 0;
+    virtual void set_stroke_mode(StrokeMode mode) = 0;
+
+    // When on, primitives are recorded and only drawn at resolve time,
+    // skipping the parts hidden behind later opaque triangles. The result
+    // is the same as drawing everything in order.
+    virtual void set_occlusion_culling(bool on) = 0;
+
+    // In retained mode the primitives of a frame are kept in a display
+    // list after it is drawn, tagged with the SVG element that drew them,
+    // so that parts of the frame can be drawn again without the SVG.
+    virtual void set_retained(bool on) = 0;
+
+    // Tags the primitives rasterized from now on
+    virtual void set_tag(int tag) = 0;
+
+    // Retained mode: the primitives rasterized between begin_update and
+    // end_update replace those tagged tag. end_update returns the pixels
+    // the old and new primitives cover, which need to be redrawn.
+    virtual void begin_update(int tag) = 0;
+    virtual bool end_update(IntRect& dirty) = 0;
+
+    // Retained mode: draws the pixels in rect again from the display list
+    // and resolves only those pixels to the framebuffer
+    virtual void redraw_region(const IntRect& rect) = 0;
+
+    // Retained mode: moves the frame by (dx, dy) pixels, for a view that
+    // was panned by exactly that much. The primitives rasterized next
+    // replace the display list, and resolve_to_framebuffer only draws the
+    // pixels the move exposed. Returns false, changing nothing, if nothing
+    // of the frame would be kept.
+    virtual bool scroll(int dx, int dy) = 0;
+
+    // Once *flag is set, drawing stops at the next primitive and leaves the
+    // frame unfinished, for frames that are no longer wanted. The buffers
+    // must be cleared before the next frame.
+    virtual void set_cancel_flag(const std::atomic<bool>* flag) = 0;
+    virtual bool cancelled() const = 0;
 
     // Rasterize a point
     virtual void rasterize_point(float x, float y, Color color) = 0;
@@ -43,14 +94,38 @@ namespace CGL {
       float x2, float y2, float u2, float v2,
       Texture& tex) = 0;
 
+    // Rasterize the stroke of a polyline in screen space, in style's stroke
+    // color, joining the last point back to the first if closed. width is
+    // in pixels; it is only honored in S_TESSELLATED mode, otherwise the
+    // stroke is drawn with one pixel wide lines. Other than a smooth
+    // hairline, a translucent stroke is composited once per sample, even
+    // where its pieces overlap.
+    virtual void rasterize_stroke(const Vector2f* points, size_t n, bool closed,
+      float width, const Style& style) = 0;
+
     // This function sets the framebuffer target.  The block of memory
     // for the framebuffer contains 3 * width * height values for an RGB
     // pixel framebuffer with 8-bits per color channel.
     virtual void set_framebuffer_target(unsigned char* rgb_framebuffer,
       size_t width, size_t height) = 0;
 
+    // Sets a target that holds only pixel rows [y0, y1) of a width x height
+    // frame, 3 * width * (y1 - y0) values starting with row y0. Only those
+    // rows are kept in the sample buffer, which is cleared, and drawn; the
+    // rest of the frame is skipped. In retained mode the display list of
+    // the frame is kept, and the next resolve_to_framebuffer draws the band
+    // from the primitives of it that overlap the band. set_framebuffer_target
+    // goes back to the whole frame.
+    virtual void set_band_target(unsigned char* rgb_band,
+      size_t width, size_t height, int y0, int y1) = 0;
+
     virtual void clear_buffers() = 0;
 
+    // Draws the recorded display list into the sample buffer without
+    // resolving it. resolve_to_framebuffer does this itself when needed;
+    // calling it first only separates the two stages.
+    virtual void draw_pending() = 0;
+
     // This function fills the target framebuffer with the
     // rasterized samples (including subpixel super-samples, if relevant)
     // in preparation for posting pixels to the screen.
@@ -66,9 +141,80 @@ namespace CGL {
     PixelSampleMethod psm;
     LevelSampleMethod lsm;
 
+    // Most probes per sample when lsm is L_ANISOTROPIC
+    unsigned int max_aniso;
+
+    // How lines and strokes are drawn
+    StrokeMode stroke_mode;
+
+    // Scratch triangle list for tessellated strokes
+    std::vector<Vector2f> stroke_triangles;
+
+    // Translucent strokes composite each sample once, however many of
+    // their segments, joins and caps cover it. Each such stroke gets an id,
+    // recorded with its primitives, and each time one is drawn its samples
+    // are stamped with a new serial; samples already stamped with the
+    // current serial are skipped. stroke_serial is 0 outside strokes.
+    unsigned int current_stroke, stroke_ids;
+    unsigned int drawn_stroke, stroke_serial, stroke_serials;
+    std::vector<unsigned int> stroke_stamp;
+
+    // Triangle kernels only write samples inside the scissor rectangle,
+    // which is normally the whole sample buffer
+    IntRect scissor;
+
+    // A primitive recorded for occlusion culling, with the arguments it
+    // was passed to rasterize_*
+    struct DrawCommand {
+      enum Type { POINT, LINE, TRIANGLE, INTERPOLATED, TEXTURED } type;
+      float v[12];
+      Color c[3];
+      Texture* tex;
+      int tag;
+      unsigned int stroke;   // id of the translucent stroke it belongs to, or 0
+    };
+
+    // Occlusion culling state. Commands are recorded since the last clear;
+    // tile_owner holds, for each kTileSize^2 tile of samples, the index of
+    // the last opaque triangle that covers it entirely, or -1, and
+    // block_owner holds the minimum of tile_owner over each block of
+    // kBlockTiles^2 tiles.
+    bool occlusion_culling;
+    bool replaying;
+    std::vector<DrawCommand> commands;
+    bool commands_pending;
+    std::vector<int> tile_owner, block_owner;
+    int tiles_w, tiles_h, blocks_w, blocks_h;
+
+    // Retained mode state. While updating, new commands go to
+    // update_commands. index holds, for each kIndexCell^2 cell of pixels,
+    // the commands whose bounds overlap it, in order.
+    bool retained;
+    int current_tag;
+    bool updating;
+    std::vector<DrawCommand> update_commands;
+    std::vector<std::vector<int>> index;
+    int index_w, index_h;
+    bool index_valid;
+
+    // The commands whose bounds overlap each kIndexCell pixel rows of the
+    // frame, in order, for finding those of a band
+    std::vector<std::vector<int>> row_index;
+    bool row_index_valid;
+
+    // Pixels left to draw after a scroll
+    std::vector<IntRect> exposed;
+
+    // Set by the owner to abandon the frame being drawn, or null
+    const std::atomic<bool>* cancel_flag;
+
     // Width & Height of the image and the output
     size_t width, height;
 
+    // The pixel rows of the frame held in the buffers, all of them unless
+    // a band target is set
+    int band_y0, band_y1;
+
     // The target pixel framebuffer connected to display. There are
     // 3 x width * height values in this RGB pixel array.
     unsigned char* rgb_framebuffer_target;
@@ -76,7 +222,8 @@ namespace CGL {
     // The internal color sample buffer, contains *all samples*
     // Organized in a matrix, stored in a 1-d vector
     // For example, Position [x,y] = [width * y + x]
-    // The number of elements in buffer = width * height * sample_rate
+    // The number of elements in buffer = width * height * sample_rate,
+    // with height the rows of the band
     std::vector<Color> sample_buffer;
 
   public:
@@ -114,24 +261,51 @@ namespace CGL {
       float x2, float y2, float u2, float v2,
       Texture& tex);
 
+    void rasterize_stroke(const Vector2f* points, size_t n, bool closed,
+      float width, const Style& style);
+
     unsigned int get_sample_rate() { return sample_rate; }
 
     void set_sample_rate(unsigned int rate);
 
     void set_psm(PixelSampleMethod p) { psm = p; }
     void set_lsm(LevelSampleMethod l) { lsm = l; }
-
-    // Fill a pixel, which may contain multiple samples
+    void set_max_anisotropy(unsigned int ratio) { max_aniso = ratio; }
+    void set_stroke_mode(StrokeMode mode) { stroke_mode = mode; }
+    void set_occlusion_culling(bool on) { occlusion_culling = on; }
+    void set_retained(bool on) { retained = on; }
+    void set_tag(int tag) { current_tag = tag; }
+
+    void begin_update(int tag);
+    bool end_update(IntRect& dirty);
+    void redraw_region(const IntRect& rect);
+    bool scroll(int dx, int dy);
+
+    void set_cancel_flag(const std::atomic<bool>* flag) { cancel_flag = flag; }
+    bool cancelled() const {
+        return cancel_flag && cancel_flag->load(std::memory_order_relaxed);
+    }
+
+    // Fill a pixel, which may contain multiple samples. Translucent colors
+    // are composited over the samples, opaque ones simply replace them.
     void fill_pixel(size_t x, size_t y, Color c);
 
+    // Blend c into every sample of a pixel, weighted by coverage
+    void blend_pixel(size_t x, size_t y, Color c, float coverage);
+
     // This function sets the framebuffer target.  The block of memory
     // for the framebuffer contains 3 * width * height values for an RGB
     // pixel framebuffer with 8-bits per color channel.
     virtual void set_framebuffer_target(unsigned char* rgb_framebuffer,
       size_t width, size_t height);
 
+    virtual void set_band_target(unsigned char* rgb_band,
+      size_t width, size_t height, int y0, int y1);
+
     virtual void clear_buffers();
 
+    virtual void draw_pending();
+
     // This function fills the target framebuffer with the
     // rasterized samples (including subpixel super-samples, if relevant)
     // in preparation for posting pixels to the screen.
@@ -140,6 +314,122 @@ namespace CGL {
     float lineEquation(float x, float y, float x0, float y0, float x1, float y1);
     void barycentricCoord(float x, float y, float x0, float y0, float x1, float y1, float x2, float y2, float *coords);
     Color averagePixels(int x, int y);
+
+  private:
+    // How far outside the framebuffer, in pixels, triangle vertices may lie
+    // before the triangle is clipped geometrically
+    static constexpr float kGuardBand = 2048;
+
+    // Occlusion buffer tile size in samples, and block size in tiles
+    static constexpr int kTileSize = 16;
+    static constexpr int kBlockTiles = 8;
+
+    // Display list index cell size in pixels
+    static constexpr int kIndexCell = 64;
+
+    // True if rasterize_* calls should be recorded rather than drawn
+    bool recording() const { return (occlusion_culling || retained || updating) && !replaying; }
+
+    // Adds a command to the display list
+    void record(DrawCommand cmd);
+
+    // Pixels covered by the commands in [first, last), or false if none
+    bool commands_pixel_bounds(const DrawCommand* first, const DrawCommand* last, IntRect& r) const;
+
+    // Rebuilds index from the display list
+    void build_index();
+
+    // Sets the scissor to the whole sample buffer
+    void reset_scissor();
+
+    // Index in sample_buffer of sample (sx, sy) of the frame, which must be
+    // in the band; rate is sqrt(sample_rate)
+    size_t sample_index(int sx, int sy, int rate) const {
+        return (size_t)(sy - band_y0 * rate) * width * rate + sx;
+    }
+
+    // The sample buffer resized to the band, and the scissor reset
+    void resize_sample_buffer();
+
+    // Rebuilds row_index from the display list
+    void build_row_index();
+
+    // True if pixel (x, y) is inside the scissor
+    bool pixel_in_scissor(size_t x, size_t y, int rate) const;
+
+    // resolve_to_framebuffer for the pixels in r
+    void resolve_region(const IntRect& r);
+
+    // Draws the recorded commands, culling hidden ones
+    void draw_commands();
+
+    // Bounding box of a command in samples, clamped to the sample buffer,
+    // or to clip. Returns false if it is off screen.
+    bool command_bounds(const DrawCommand& cmd, IntRect& r) const;
+    bool command_bounds(const DrawCommand& cmd, const IntRect& clip, IntRect& r) const;
+
+    // True if every tile in [tx0, tx1) x [ty0, ty1) is covered by an opaque
+    // triangle recorded after command index
+    bool tiles_hidden(int tx0, int tx1, int ty0, int ty1, int index) const;
+
+    // Marks the tiles covered entirely by the opaque triangle at index
+    void mark_covered_tiles(const DrawCommand& cmd, int index, const IntRect& r);
+
+    // Rasterizes a recorded command
+    void draw_command(const DrawCommand& cmd);
+
+    // Starts drawing the primitives of translucent stroke id, or of no
+    // stroke if id is 0
+    void begin_stroke(unsigned int id);
+
+    // Writes src to sample i: a plain store without BLEND, otherwise
+    // composited over it, once per translucent stroke
+    template <bool BLEND>
+    void write_sample(size_t i, const Color& src);
+
+    // rasterize_triangle for a triangle inside the guard band. With BLEND
+    // the color is composited over the samples, otherwise it is stored.
+    template <bool BLEND>
+    void fill_triangle(float x0, float y0,
+      float x1, float y1,
+      float x2, float y2,
+      Color color);
+
+    // Fill a convex polygon of up to 7 vertices, given as x y pairs
+    template <bool BLEND>
+    void fill_convex_polygon(const float* poly, int n, Color color);
+
+    // rasterize_interpolated_color_triangle, compositing with BLEND
+    template <bool BLEND>
+    void interpolated_color_triangle(float x0, float y0, Color c0,
+      float x1, float y1, Color c1,
+      float x2, float y2, Color c2);
+
+    // rasterize_line in S_SMOOTH_HAIRLINE mode
+    void rasterize_smooth_line(float x0, float y0, float x1, float y1, Color color);
+
+    typedef void (RasterizerImp::*TexturedTriangleKernel)(float x0, float y0, float u0, float v0,
+      float x1, float y1, float u1, float v1,
+      float x2, float y2, float u2, float v2,
+      Texture& tex);
+
+    // Inner loop of rasterize_textured_triangle, specialized on the sampling
+    // methods and on the supersampling grid size, sqrt(sample_rate).
+    // A RATE of 0 reads the grid size at run time.
+    template <PixelSampleMethod P, LevelSampleMethod L, int RATE>
+    void textured_triangle_kernel(float x0, float y0, float u0, float v0,
+      float x1, float y1, float u1, float v1,
+      float x2, float y2, float u2, float v2,
+      Texture& tex);
+
+    // Picks the kernel instantiation for the current psm, lsm and sample rate
+    TexturedTriangleKernel select_textured_kernel();
+
+    template <PixelSampleMethod P>
+    static TexturedTriangleKernel textured_kernel_for_lsm(LevelSampleMethod lsm, unsigned int sample_rate);
+
+    template <PixelSampleMethod P, LevelSampleMethod L>
+    static TexturedTriangleKernel textured_kernel_for_rate(unsigned int sample_rate);
   };
 
 
@@ -0,0 +1,73 @@
+#include "render_stats.h"
+
+#include <sstream>
+#include <iomanip>
+
+using namespace std;
+
+namespace CGL {
+
+static const char* primitive_names[] = { "points", "lines", "triangles", "interpolated", "textured" };
+static const char* stage_names[] = { "parse", "draw", "triangulate", "rasterize", "resolve", "mipmap" };
+
+// n with a k or M suffix past a few digits
+static string count_string(uint64_t n) {
+  stringstream ss;
+  ss << fixed << setprecision(1);
+  if (n >= 10000000) ss << n / 1e6 << "M";
+  else if (n >= 10000) ss << n / 1e3 << "k";
+  else ss << n;
+  return ss.str();
+}
+
+uint64_t RenderStats::total_primitives() const {
+  uint64_t n = 0;
+  for (int i = 0; i < PRIMITIVE_TYPES; ++i) n += primitives[i];
+  return n;
+}
+
+string RenderStats::summary() const {
+  stringstream ss;
+  ss << count_string(total_primitives()) << " primitives";
+  if (culled) ss << ", " << count_string(culled) << " culled";
+  ss << ". " << count_string(samples_tested) << " samples tested, "
+     << count_string(samples_written) << " written. ";
+  ss << count_string(texture_taps) << " texture taps.";
+
+  ss << "\n" << fixed << setprecision(2);
+  for (int s = 0; s < STAGES; ++s) {
+    ss << (s ? ", " : "") << stage_names[s] << " " << seconds[s] * 1000 << " ms";
+  }
+  ss << ".";
+
+  if (texture_taps) {
+    ss << "\nLookups per mip level:";
+    for (int i = 0; i < kMipLevels; ++i) {
+      if (mip_lookups[i]) ss << " " << i << ": " << count_string(mip_lookups[i]);
+    }
+  }
+  return ss.str();
+}
+
+string RenderStats::json() const {
+  stringstream ss;
+  ss << "{\n  \"primitives\": {";
+  for (int i = 0; i < PRIMITIVE_TYPES; ++i) {
+    ss << "\"" << primitive_names[i] << "\": " << primitives[i] << ", ";
+  }
+  ss << "\"culled\": " << culled << "},\n";
+  ss << "  \"samples_tested\": " << samples_tested << ",\n";
+  ss << "  \"samples_written\": " << samples_written << ",\n";
+  ss << "  \"texture_taps\": " << texture_taps << ",\n";
+  ss << "  \"mip_lookups\": [";
+  for (int i = 0; i < kMipLevels; ++i) ss << (i ? ", " : "") << mip_lookups[i];
+  ss << "],\n  \"stages_ms\": {";
+  ss << fixed << setprecision(4);
+  for (int s = 0; s < STAGES; ++s) {
+    ss << (s ? ", " : "") << "\"" << stage_names[s] << "\": " << seconds[s] * 1000;
+  }
+  ss << "}\n}\n";
+  return ss.str();
+}
+
+} // namespace CGL
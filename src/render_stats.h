@@ -0,0 +1,103 @@
+#ifndef CGL_RENDER_STATS_H
+#define CGL_RENDER_STATS_H
+
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+namespace CGL {
+
+/**
+ * Counters and stage timers for finding out where the time of a frame
+ * goes. They are only kept in builds with DRAW_STATS defined (the
+ * BUILD_STATS CMake option); elsewhere the STATS_ macros below compile to
+ * nothing.
+ *
+ * Each thread counts into its own RenderStats, so the hot loops never
+ * share a cache line. Kernels count into locals and add them once per
+ * primitive; texture lookups are counted as they happen.
+ */
+struct RenderStats {
+  enum Primitive { POINTS, LINES, TRIANGLES, INTERPOLATED, TEXTURED, PRIMITIVE_TYPES };
+
+  // Stages nest: draw includes triangulate, and rasterize includes
+  // mipmaps generated on first use
+  enum Stage {
+    PARSE,       // SVGParser::load, textures included
+    DRAW,        // SVG::draw: transforming the elements and handing them to
+                 // the rasterizer, which rasterizes them right away unless
+                 // it records a display list
+    TRIANGULATE, // triangulating polygons and tessellating strokes
+    RASTERIZE,   // drawing the recorded display list into the sample buffer
+    RESOLVE,     // averaging the sample buffer into the framebuffer
+    MIPMAP,      // filtering mip levels
+    STAGES
+  };
+
+  static const int kMipLevels = 16;
+
+  // Primitives handed to the rasterizer, and recorded ones skipped by
+  // occlusion culling
+  uint64_t primitives[PRIMITIVE_TYPES];
+  uint64_t culled;
+
+  // Samples whose coverage a triangle kernel tested, and samples written
+  // by any primitive
+  uint64_t samples_tested;
+  uint64_t samples_written;
+
+  // Texels read, and lookups into each mip level
+  uint64_t texture_taps;
+  uint64_t mip_lookups[kMipLevels];
+
+  double seconds[STAGES];
+
+  void clear() { *this = RenderStats(); }
+
+  uint64_t total_primitives() const;
+
+  // A few lines of text for the on-screen display
+  std::string summary() const;
+
+  // The counters and the stage times in milliseconds, as a JSON object
+  std::string json() const;
+};
+
+// The stats of the calling thread
+inline RenderStats& render_stats() {
+  static thread_local RenderStats stats;
+  return stats;
+}
+
+// Adds the time from its construction to its destruction to a stage
+class StageTimer {
+ public:
+  explicit StageTimer(RenderStats::Stage stage)
+    : stage(stage), t0(std::chrono::steady_clock::now()) { }
+
+  ~StageTimer() {
+    render_stats().seconds[stage] +=
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  }
+
+ private:
+  RenderStats::Stage stage;
+  std::chrono::steady_clock::time_point t0;
+};
+
+#define STATS_CONCAT_(a, b) a##b
+#define STATS_CONCAT(a, b) STATS_CONCAT_(a, b)
+
+#ifdef DRAW_STATS
+// Adds n to a counter of the calling thread
+#define STATS_ADD(counter, n) (render_stats().counter += (n))
+// Times the rest of the enclosing scope as a stage
+#define STATS_TIME(stage) StageTimer STATS_CONCAT(stats_timer_, __LINE__)(RenderStats::stage)
+#else
+#define STATS_ADD(counter, n) ((void)(n))
+#define STATS_TIME(stage) ((void)0)
+#endif
+
+} // namespace CGL
+
+#endif // CGL_RENDER_STATS_H
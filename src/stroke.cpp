@@ -0,0 +1,158 @@
+#include "stroke.h"
+
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+namespace CGL {
+
+// Largest distance allowed between a round join or cap and the true arc,
+// in the units of the input points (pixels for screen space strokes).
+static const float ARC_TOLERANCE = 0.1f;
+
+// Points closer together than this are treated as the same vertex.
+static const float VERTEX_EPSILON = 1e-6f;
+
+// left-hand normal of a direction
+static inline Vector2f perp(const Vector2f& d) {
+  return Vector2f(-d.y, d.x);
+}
+
+static inline Vector2f rotate(const Vector2f& v, float theta) {
+  float c = cosf(theta), s = sinf(theta);
+  return Vector2f(v.x * c - v.y * s, v.x * s + v.y * c);
+}
+
+static inline void emit(vector<Vector2f>& out,
+                        const Vector2f& a, const Vector2f& b, const Vector2f& c) {
+  out.push_back(a);
+  out.push_back(b);
+  out.push_back(c);
+}
+
+// Fans an arc of radius |from| around center, sweeping by theta radians.
+static void emit_arc(vector<Vector2f>& out, const Vector2f& center,
+                     const Vector2f& from, float theta) {
+  float r = from.norm();
+  float step = r > ARC_TOLERANCE ? 2 * acosf(1 - ARC_TOLERANCE / r) : (float)M_PI / 2;
+  int steps = max(1, (int)ceilf(fabsf(theta) / step));
+
+  Vector2f prev = from;
+  for (int i = 1; i <= steps; ++i) {
+    Vector2f next = i == steps ? rotate(from, theta) : rotate(from, theta * i / steps);
+    emit(out, center, center + prev, center + next);
+    prev = next;
+  }
+}
+
+// Fills the wedge on the outside of the turn at p, from the end of the
+// segment with direction d0 to the start of the segment with direction d1.
+static void emit_join(vector<Vector2f>& out, const Vector2f& p,
+                      const Vector2f& d0, const Vector2f& d1,
+                      float hw, const Style& style) {
+  float c = cross(d0, d1);
+  if (fabsf(c) < VERTEX_EPSILON && dot(d0, d1) > 0) return; // straight
+
+  // the outer side is opposite to the direction of the turn
+  float side = c > 0 ? -hw : hw;
+  Vector2f a = perp(d0) * side, b = perp(d1) * side;
+
+  if (style.strokeJoin == JOIN_ROUND) {
+    emit_arc(out, p, a, atan2f(cross(a, b), dot(a, b)));
+    return;
+  }
+
+  if (style.strokeJoin == JOIN_MITER) {
+    // the miter tip lies along the bisector of the two offsets; its
+    // distance from p over the half width is 1 / cos(half the turn)
+    Vector2f bisector = a + b;
+    float len = bisector.norm();
+    if (len > VERTEX_EPSILON) {
+      bisector /= len;
+      float ratio = hw / dot(bisector, a);
+      if (ratio <= style.miterLimit) {
+        Vector2f tip = p + bisector * (hw * ratio);
+        emit(out, p, p + a, tip);
+        emit(out, p, tip, p + b);
+        return;
+      }
+    }
+  }
+
+  // bevel, also the fallback for miters past the limit
+  emit(out, p, p + a, p + b);
+}
+
+// Adds the cap at endpoint p of a segment; d points away from the stroke.
+static void emit_cap(vector<Vector2f>& out, const Vector2f& p,
+                     const Vector2f& d, float hw, const Style& style) {
+  Vector2f n = perp(d) * hw;
+  if (style.strokeCap == CAP_ROUND) {
+    // sweep from -n through d to n
+    emit_arc(out, p, -n, (float)M_PI);
+  } else if (style.strokeCap == CAP_SQUARE) {
+    Vector2f e = d * hw;
+    emit(out, p + n, p - n, p + n + e);
+    emit(out, p + n + e, p - n, p - n + e);
+  }
+}
+
+void stroke_polyline(const Vector2f* points, size_t n, bool closed,
+                     float width, const Style& style,
+                     vector<Vector2f>& triangles) {
+  float hw = width / 2;
+  if (!(hw > 0) || n == 0) return;
+
+  // drop repeated vertices, which have no direction
+  vector<Vector2f> pts;
+  pts.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    if (pts.empty() || (points[i] - pts.back()).norm2() > VERTEX_EPSILON)
+      pts.push_back(points[i]);
+  }
+  if (closed && pts.size() > 1 && (pts.front() - pts.back()).norm2() <= VERTEX_EPSILON)
+    pts.pop_back();
+
+  size_t m = pts.size();
+
+  // a zero length stroke only shows its caps
+  if (m == 1) {
+    if (style.strokeCap == CAP_ROUND) {
+      emit_arc(triangles, pts[0], Vector2f(hw, 0), 2 * (float)M_PI);
+    } else if (style.strokeCap == CAP_SQUARE) {
+      Vector2f p = pts[0];
+      emit(triangles, p + Vector2f(-hw, -hw), p + Vector2f(hw, -hw), p + Vector2f(-hw, hw));
+      emit(triangles, p + Vector2f(hw, -hw), p + Vector2f(hw, hw), p + Vector2f(-hw, hw));
+    }
+    return;
+  }
+
+  if (m == 2) closed = false;
+  size_t segments = closed ? m : m - 1;
+
+  // one quad per segment
+  vector<Vector2f> dirs(segments);
+  for (size_t i = 0; i < segments; ++i) {
+    const Vector2f& p0 = pts[i];
+    const Vector2f& p1 = pts[(i + 1) % m];
+    dirs[i] = (p1 - p0).unit();
+
+    Vector2f o = perp(dirs[i]) * hw;
+    emit(triangles, p0 + o, p0 - o, p1 + o);
+    emit(triangles, p1 + o, p0 - o, p1 - o);
+  }
+
+  // joins at interior vertices, or at every vertex of a closed polyline
+  for (size_t i = closed ? 0 : 1; i < (closed ? m : m - 1); ++i) {
+    const Vector2f& d0 = dirs[(i + segments - 1) % segments];
+    emit_join(triangles, pts[i], d0, dirs[i], hw, style);
+  }
+
+  if (!closed) {
+    emit_cap(triangles, pts[0], -dirs[0], hw, style);
+    emit_cap(triangles, pts[m - 1], dirs[segments - 1], hw, style);
+  }
+}
+
+} // namespace CGL
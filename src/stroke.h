@@ -0,0 +1,17 @@
+#ifndef CGL_STROKE_H
+#define CGL_STROKE_H
+
+#include "svg.h"
+
+namespace CGL {
+
+// Tessellates a stroke of the given width along a polyline and appends it
+// to triangles as a triangle list. Joins and caps are taken from style;
+// a closed polyline is joined at its first vertex instead of being capped.
+void stroke_polyline(const Vector2f* points, size_t n, bool closed,
+                     float width, const Style& style,
+                     std::vector<Vector2f>& triangles);
+
+} // namespace CGL
+
+#endif // CGL_STROKE_H
@@ -6,7 +6,10 @@
 
 #include "drawrend.h"
 #include "transforms.h"
+#include "CGL/matrix2x3.h"
 #include "triangulation.h"
+#include "texture_cache.h"
+#include "render_stats.h"
 #include <iostream>
 
 #include "CGL/lodepng.h"
@@ -19,20 +22,47 @@ Group::~Group() {
   } elements.clear();
 }
 
+Image::~Image() {
+  TextureCache::release(tex);
+}
+
 SVG::~SVG() {
   for (size_t i = 0; i < elements.size(); i++) {
     delete elements[i];
   } elements.clear();
+
+  std::map<std::string, Texture*>::iterator it;
+  for (it = textures.begin(); it != textures.end(); ++it) {
+    TextureCache::release(it->second);
+  } textures.clear();
 }
 
 // Draw routines //
 
+// SVG transforms (and the view transform) are affine, so vertices are mapped
+// to screen space through Matrix2x3, without a homogeneous divide.
+
+// Screen space vertices of the element being drawn. Reused across draw calls
+// so that transforming a point list does not allocate; one per thread.
+static std::vector<Vector2f>& screen_points(size_t n) {
+  static thread_local std::vector<Vector2f> scratch;
+  if (scratch.size() < n) scratch.resize(n);
+  return scratch;
+}
+
+// Stroke width in pixels. Non-uniform scales are approximated by the
+// geometric mean of the two axis scales.
+static float stroke_width(const Style& style, const Matrix2x3& m) {
+  return style.strokeWidth * sqrt(fabs(m.det()));
+}
+
 void Triangle::draw(Rasterizer*dr, Matrix3x3 global_transform) {
   global_transform = global_transform * transform;
+  Matrix2x3 m(global_transform);
 
-  Vector2D p0_scr = global_transform * p0_svg;
-  Vector2D p1_scr = global_transform * p1_svg;
-  Vector2D p2_scr = global_transform * p2_svg;
+  Vector2f p0_scr = m * p0_svg;
+  Vector2f p1_scr = m * p1_svg;
+  Vector2f p2_scr = m * p2_svg;
 
   // draw fill. Here the color field is empty, since children
   // export their own more sophisticated color() method.
@@ -41,10 +71,11 @@ void Triangle::draw(Rasterizer*dr, Matrix3x3 global_transform) {
 
 void InterpolatedColorTriangle::draw(Rasterizer*dr, Matrix3x3 global_transform) {
   global_transform = global_transform * transform;
+  Matrix2x3 m(global_transform);
 
-  Vector2D p0_scr = global_transform * p0_svg;
-  Vector2D p1_scr = global_transform * p1_svg;
-  Vector2D p2_scr = global_transform * p2_svg;
+  Vector2f p0_scr = m * p0_svg;
+  Vector2f p1_scr = m * p1_svg;
+  Vector2f p2_scr = m * p2_svg;
 
   // draw fill. Here the color field is empty, since children
   // export their own more sophisticated color() method.
@@ -55,10 +86,11 @@ void InterpolatedColorTriangle::draw(Rasterizer*dr, Matrix3x3 global_transform)
 
 void TexturedTriangle::draw(Rasterizer*dr, Matrix3x3 global_transform) {
   global_transform = global_transform * transform;
+  Matrix2x3 m(global_transform);
 
-  Vector2D p0_scr = global_transform * p0_svg;
-  Vector2D p1_scr = global_transform * p1_svg;
-  Vector2D p2_scr = global_transform * p2_svg;
+  Vector2f p0_scr = m * p0_svg;
+  Vector2f p1_scr = m * p1_svg;
+  Vector2f p2_scr = m * p2_svg;
 
   // draw fill. Here the color field is empty, since children
   // export their own more sophisticated color() method.
@@ -68,6 +100,15 @@ void TexturedTriangle::draw(Rasterizer*dr, Matrix3x3 global_transform) {
                                   *this->tex);
 }
 
+void SVG::draw(Rasterizer*dr, Matrix3x3 global_transform) {
+  STATS_TIME(DRAW);
+  for (int i = 0; i < elements.size(); ++i) {
+    if (dr->cancelled()) return;
+    dr->set_tag(i);
+    elements[i]->draw(dr, global_transform);
+  }
+}
+
 void Group::draw(Rasterizer*dr, Matrix3x3 global_transform) {
   global_transform = global_transform * transform;
 
@@ -77,34 +118,35 @@ void Group::draw(Rasterizer*dr, Matrix3x3 global_transform) {
 
 void Point::draw(Rasterizer*dr, Matrix3x3 global_transform) {
   global_transform = global_transform * transform;
-  Vector2D p = global_transform * position;
+  Vector2f p = Matrix2x3(global_transform) * position;
   dr->rasterize_point(p.x, p.y, style.fillColor);
 }
 
 void Line::draw(Rasterizer*dr, Matrix3x3 global_transform) {
   global_transform = global_transform * transform;
+  Matrix2x3 m(global_transform);
 
-  Vector2D f = global_transform * from, t = global_transform * to;
+  Vector2f p[2] = { m * from, m * to };
   if (style.strokeVisible) {
-    dr->rasterize_line(f.x, f.y, t.x, t.y, style.strokeColor);
+    dr->rasterize_stroke(p, 2, false, stroke_width(style, m), style);
   }
 }
 
 void Polyline::draw(Rasterizer*dr, Matrix3x3 global_transform) {
   global_transform = global_transform * transform;
+  Matrix2x3 m(global_transform);
 
-  Color c = style.strokeColor;
-
+  // transform every vertex once, then stroke from the buffer
   int nPoints = points.size();
-  for( int i = 0; i < nPoints - 1; i++ ) {
-    Vector2D p0 = global_transform * points[(i+0) % nPoints];
-    Vector2D p1 = global_transform * points[(i+1) % nPoints];
-    dr->rasterize_line( p0.x, p0.y, p1.x, p1.y, c );
-  }
+  std::vector<Vector2f>& p = screen_points(nPoints);
+  m.transform(points.data(), p.data(), nPoints);
+
+  dr->rasterize_stroke( p.data(), nPoints, false, stroke_width(style, m), style );
 }
 
 void Rect::draw(Rasterizer*dr, Matrix3x3 global_transform) {
   global_transform = global_transform * transform;
+  Matrix2x3 m(global_transform);
 
   Color c;
 
@@ -112,10 +154,10 @@ void Rect::draw(Rasterizer*dr, Matrix3x3 global_transform) {
   float x =  position.x, y =  position.y;
   float w = dimension.x, h = dimension.y;
 
-  Vector2D p0 = global_transform * Vector2D(   x   ,   y   );
-  Vector2D p1 = global_transform * Vector2D( x + w ,   y   );
-  Vector2D p2 = global_transform * Vector2D(   x   , y + h );
-  Vector2D p3 = global_transform * Vector2D( x + w , y + h );
+  Vector2f p0 = m * Vector2f(   x   ,   y   );
+  Vector2f p1 = m * Vector2f( x + w ,   y   );
+  Vector2f p2 = m * Vector2f(   x   , y + h );
+  Vector2f p3 = m * Vector2f( x + w , y + h );
 
   // draw fill
   c = style.fillColor;
@@ -124,16 +166,14 @@ void Rect::draw(Rasterizer*dr, Matrix3x3 global_transform) {
 
   // draw outline
   if (style.strokeVisible) {
-    c = style.strokeColor;
-    dr->rasterize_line( p0.x, p0.y, p1.x, p1.y, c );
-    dr->rasterize_line( p1.x, p1.y, p3.x, p3.y, c );
-    dr->rasterize_line( p3.x, p3.y, p2.x, p2.y, c );
-    dr->rasterize_line( p2.x, p2.y, p0.x, p0.y, c );
+    Vector2f outline[4] = { p0, p1, p3, p2 };
+    dr->rasterize_stroke( outline, 4, true, stroke_width(style, m), style );
   }
 }
 
 void Polygon::draw(Rasterizer*dr, Matrix3x3 global_transform) {
   global_transform = global_transform * transform;
+  Matrix2x3 m(global_transform);
 
   Color c;
 
@@ -141,37 +181,42 @@ void Polygon::draw(Rasterizer*dr, Matrix3x3 global_transform) {
   c = style.fillColor;
 
   // triangulate
-  std::vector<Vector2D> triangles;
-  triangulate( *this, triangles );
+  static thread_local std::vector<Vector2D> triangles;
+  triangles.clear();
+  {
+    STATS_TIME(TRIANGULATE);
+    triangulate( *this, triangles );
+  }
+
+  // transform the whole triangle list in one pass
+  std::vector<Vector2f>& t = screen_points(triangles.size());
+  m.transform(triangles.data(), t.data(), triangles.size());
 
   // draw as triangles
   for (size_t i = 0; i < triangles.size(); i += 3) {
-    Vector2D p0 = global_transform * triangles[i + 0];
-    Vector2D p1 = global_transform * triangles[i + 1];
-    Vector2D p2 = global_transform * triangles[i + 2];
-    dr->rasterize_triangle( p0.x, p0.y, p1.x, p1.y, p2.x, p2.y, c );
+    dr->rasterize_triangle( t[i].x, t[i].y, t[i+1].x, t[i+1].y, t[i+2].x, t[i+2].y, c );
   }
 
   // draw outline
   if (style.strokeVisible) {
-    c = style.strokeColor;
     int nPoints = points.size();
-    for( int i = 0; i < nPoints; i++ ) {
-      Vector2D p0 = global_transform * points[(i+0) % nPoints];
-      Vector2D p1 = global_transform * points[(i+1) % nPoints];
-      dr->rasterize_line( p0.x, p0.y, p1.x, p1.y, c );
-    }
+    std::vector<Vector2f>& p = screen_points(nPoints);
+    m.transform(points.data(), p.data(), nPoints);
+
+    dr->rasterize_stroke( p.data(), nPoints, true, stroke_width(style, m), style );
   }
 }
 
 void Image::draw(Rasterizer*dr, Matrix3x3 global_transform) {
+  if (!tex) return;
+
   global_transform = global_transform * transform;
   Vector2D p0 = global_transform * position;
   Vector2D p1 = global_transform * (position + dimension);
 
   for (int x = floor(p0.x); x <= floor(p1.x); ++x) {
     for (int y = floor(p0.y); y <= floor(p1.y); ++y) {
-      Color col = tex.sample_bilinear(Vector2D((x+.5-p0.x)/(p1.x-p0.x+1), (y+.5-p0.y)/(p1.y-p0.y+1)));
+      Color col = tex->sample_bilinear(Vector2D((x+.5-p0.x)/(p1.x-p0.x+1), (y+.5-p0.y)/(p1.y-p0.y+1)));
       dr->rasterize_point(x,y,col);
     }
   }
@@ -11,6 +11,7 @@
 #include "CGL/color.h"
 // #include "texture.h"
 #include "CGL/vector2D.h"
+#include "CGL/vector2f.h"
 #include "CGL/matrix3x3.h"
 #include "CGL/tinyxml2.h"
 using namespace tinyxml2;
@@ -35,12 +36,31 @@ typedef enum e_SVGElementType {
   TRIANGLE
 } SVGElementType;
 
+typedef enum e_LineJoin {
+  JOIN_MITER = 0,
+  JOIN_ROUND,
+  JOIN_BEVEL
+} LineJoin;
+
+typedef enum e_LineCap {
+  CAP_BUTT = 0,
+  CAP_ROUND,
+  CAP_SQUARE
+} LineCap;
+
 struct Style {
+
+  // SVG defaults for the stroke attributes
+  Style() : strokeWidth( 1 ), miterLimit( 4 ), strokeVisible( false ),
+            strokeJoin( JOIN_MITER ), strokeCap( CAP_BUTT ) { }
+
   Color strokeColor;
   Color fillColor;
   float strokeWidth;
   float miterLimit;
   bool strokeVisible;
+  LineJoin strokeJoin;
+  LineCap strokeCap;
 };
 
 struct SVGElement {
@@ -159,13 +179,17 @@ struct Polygon : SVGElement {
 
 struct Image : SVGElement {
 
-  Image() : SVGElement  ( IMAGE ) { }
+  Image() : SVGElement  ( IMAGE ), tex( NULL ) { }
   Vector2D position;
   Vector2D dimension;
-  Texture tex;
+
+  // Shared with other users of the same image through the TextureCache
+  Texture *tex;
 
   void draw(Rasterizer*dr, Matrix3x3 global_transform);
-  
+
+  ~Image();
+
 };
 
 struct SVG {
@@ -173,12 +197,13 @@ struct SVG {
   ~SVG();
   float width, height;
   std::vector<SVGElement*> elements;
+
+  // Textures by texid. Each holds one TextureCache reference.
   std::map<std::string, Texture*> textures;
 
-  void draw(Rasterizer*dr, Matrix3x3 global_transform) {
-    for (int i = 0; i < elements.size(); ++i)
-      elements[i]->draw(dr, global_transform);
-  }
+  // Draws the elements in order, tagging each one's primitives with its
+  // index in elements
+  void draw(Rasterizer*dr, Matrix3x3 global_transform);
 
 };
 
@@ -5,6 +5,8 @@
 #include "CGL/base64.h"
 #include "CGL/lodepng.h"
 #include "texture.h"
+#include "texture_cache.h"
+#include "render_stats.h"
 
 #include <string>
 #include <fstream>
@@ -22,6 +24,7 @@ string SVGParser::dir;
 // Parser //
 
 int SVGParser::load( const char* filename, SVG* svg ) {
+  STATS_TIME(PARSE);
 
   ifstream in( filename );
   if( !in.is_open() ) {
@@ -155,25 +158,46 @@ void SVGParser::parseElement( XMLElement* xml, SVGElement* element ) {
   const char* fill = xml->Attribute( "fill" );
   if( fill ) style->fillColor = Color::fromHex( fill );
 
-  //const char* fill_opacity = xml->Attribute( "fill-opacity" );
-  //if( fill_opacity ) style->fillColor.a = atof( fill_opacity );
+  // colors are premultiplied, so opacity scales every channel. The
+  // element opacity is applied to fill and stroke separately rather than
+  // to the element as a whole.
+  float opacity = 1, fill_opacity = 1, stroke_opacity = 1;
+  xml->QueryFloatAttribute( "opacity",        &opacity        );
+  xml->QueryFloatAttribute( "fill-opacity",   &fill_opacity   );
+  xml->QueryFloatAttribute( "stroke-opacity", &stroke_opacity );
+  style->fillColor *= clamp( opacity * fill_opacity, 0.f, 1.f );
 
   const char* stroke = xml->Attribute( "stroke" );
-  //const char* stroke_opacity = xml->Attribute( "stroke-opacity" );
   if( stroke ) {
     style->strokeColor = Color::fromHex( stroke );
     style->strokeVisible = true;
-    //if( stroke_opacity ) style->strokeColor.a = atof( stroke_opacity );
+    style->strokeColor *= clamp( opacity * stroke_opacity, 0.f, 1.f );
   } else {
     style->strokeColor = Color::Black;
     style->strokeVisible = false;
-    //style->strokeColor.a = 0;
+    style->strokeColor.a = 0;
   }
 
 
   xml->QueryFloatAttribute( "stroke-width",      &style->strokeWidth );
   xml->QueryFloatAttribute( "stroke-miterlimit", &style->miterLimit  );
 
+  const char* linejoin = xml->Attribute( "stroke-linejoin" );
+  if( linejoin ) {
+    string join = linejoin;
+    if      ( join == "round" ) style->strokeJoin = JOIN_ROUND;
+    else if ( join == "bevel" ) style->strokeJoin = JOIN_BEVEL;
+    else                        style->strokeJoin = JOIN_MITER;
+  }
+
+  const char* linecap = xml->Attribute( "stroke-linecap" );
+  if( linecap ) {
+    string cap = linecap;
+    if      ( cap == "round"  ) style->strokeCap = CAP_ROUND;
+    else if ( cap == "square" ) style->strokeCap = CAP_SQUARE;
+    else                        style->strokeCap = CAP_BUTT;
+  }
+
   // parse transformation
   const char* trans = xml->Attribute( "transform" );
   if ( trans ) {
@@ -266,16 +290,39 @@ void SVGParser::parseTexture( XMLElement* xml ) {
   string texid = xml->Attribute("texid");
 
   const char* file = xml->Attribute( "filename" );
-  vector<unsigned char> pixels;
-  unsigned int width, height;
-  int err = lodepng::decode(pixels, width, height, dir + string(file));
-  if (err) {
+  vector<unsigned char> buffer;
+  lodepng::load_file(buffer, dir + string(file));
+
+  Texture *tex = loadTexture(buffer.data(), buffer.size());
+  if (!tex) {
     cerr << " could not load image " << file << endl;
     return;
   }
 
+  // a redefined texid replaces the earlier texture
+  TextureCache::release(curr_svg->textures[texid]);
+  curr_svg->textures[texid] = tex;
+
+}
+
+Texture* SVGParser::loadTexture( const unsigned char* data, size_t size ) {
+
+  if (!size) return NULL;
+
+  // identical image data shares one decoded, mipmapped texture
+  string key = TextureCache::key_for(data, size);
+  if (Texture::default_layout == TEXELS_TILED) key += ":tiled";
+  Texture *tex = TextureCache::acquire(key);
+  if (tex) return tex;
+
+  vector<unsigned char> pixels;
+  unsigned int width, height;
+  int err = lodepng::decode(pixels, width, height, data, size);
+  if (err) return NULL;
+
   // Strip the alpha channel
   vector<unsigned char> pixels_no_alpha;
+  pixels_no_alpha.reserve(3 * width * height);
   for (int y = 0; y < height; ++y) {
     for (int x = 0; x < width; ++x) {
       for (int k = 0; k < 3; ++k) {
@@ -284,10 +331,9 @@ void SVGParser::parseTexture( XMLElement* xml ) {
     }
   }
 
-  Texture *tex = new Texture();
+  tex = new Texture();
   tex->init(pixels_no_alpha, width, height);
-  curr_svg->textures[texid] = tex;
-
+  return TextureCache::insert(key, tex);
 }
 
 
@@ -355,36 +401,11 @@ void SVGParser::parseImage( XMLElement* xml, Image* image ) {
   const unsigned char* buffer = (unsigned char*) decoded.c_str(); 
   size_t size = decoded.size();
 
-  vector<unsigned char> pixels;
-  unsigned int width, height;
-  int err = lodepng::decode(pixels, width, height, buffer, size);
-  if (err) {
+  image->tex = loadTexture(buffer, size);
+  if (!image->tex) {
     cerr << " could not load image " << endl;
     return;
   }
-  // load into png
-  // PNG png; PNGParser::load(buffer, size, png);
-  
-  // Strip the alpha channel
-  vector<unsigned char> pixels_no_alpha;
-  for (int y = 0; y < height; ++y) {
-    for (int x = 0; x < width; ++x) {
-      for (int k = 0; k < 3; ++k) {
-        pixels_no_alpha.push_back(pixels[4 * (y * width + x) + k]);
-      }
-    }
-  }
-  
-  // create bitmap texture from png (mip level 0)
-  MipLevel mip_start;
-  mip_start.width  = width;
-  mip_start.height = height;
-  mip_start.texels = pixels_no_alpha;
-
-  // add to svg
-  image->tex.width  = mip_start.width;
-  image->tex.height = mip_start.height;
-  image->tex.mipmap.push_back(mip_start);
 }
 
 void SVGParser::parseGroup( XMLElement* xml, Group* group ) {
@@ -492,11 +513,11 @@ void SVGParser::parseColorTri( XMLElement* xml, InterpolatedColorTriangle* ctri
 
   stringstream colors (xml->Attribute( "colors" ));
 
+  // straight alpha in the file, premultiplied in memory
   float r,g,b,a;
-  // Alpha removed
-  colors >> r >> g >> b >> a; ctri->p0_col = Color(r,g,b);
-  colors >> r >> g >> b >> a; ctri->p1_col = Color(r,g,b);
-  colors >> r >> g >> b >> a; ctri->p2_col = Color(r,g,b);
+  colors >> r >> g >> b >> a; ctri->p0_col = Color(r,g,b) * a;
+  colors >> r >> g >> b >> a; ctri->p1_col = Color(r,g,b) * a;
+  colors >> r >> g >> b >> a; ctri->p2_col = Color(r,g,b) * a;
 
 }
 
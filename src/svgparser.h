@@ -24,6 +24,9 @@ class SVGParser {
 
   // parse a common texture file
   static void parseTexture   ( XMLElement* xml );
+
+  // decode png data into a texture, or fetch it from the texture cache
+  static Texture* loadTexture( const unsigned char* data, size_t size );
   
   // parse type specific properties
   static void parsePoint     ( XMLElement* xml, Point*    point       );
@@ -1,33 +1,38 @@
 #include "texture.h"
 #include "CGL/color.h"
+#include "render_stats.h"
 
 #include <cmath>
+#include <cstring>
 #include <algorithm>
+#include <functional>
+#include <thread>
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
 
 namespace CGL {
 
     Color Texture::sample(const SampleParams& sp) {
+        if (sp.lsm == L_ANISOTROPIC) {
+            AnisoFootprint fp = get_footprint(sp.p_dx_uv - sp.p_uv, sp.p_dy_uv - sp.p_uv, sp.max_aniso);
+            if (sp.psm == P_NEAREST) { return sample_aniso<P_NEAREST>(sp.p_uv, fp); }
+            else { return sample_aniso<P_LINEAR>(sp.p_uv, fp); }
+        }
+
         float level = get_level(sp);
         if (level > mipmap.size())
             return Color(1, 0, 1);
         if (sp.lsm == L_ZERO) {
-            if (sp.psm == P_NEAREST) { return sample_nearest(sp.p_uv); }
-            else if (sp.psm == P_LINEAR) { return sample_bilinear(sp.p_uv); }
+            if (sp.psm == P_NEAREST) { return sample_at<P_NEAREST, L_ZERO>(sp.p_uv, level); }
+            else if (sp.psm == P_LINEAR) { return sample_at<P_LINEAR, L_ZERO>(sp.p_uv, level); }
         } else if (sp.lsm == L_NEAREST) {
-            level = round(level);
-            if (sp.psm == P_NEAREST) { return sample_nearest(sp.p_uv, level); }
-            else if (sp.psm == P_LINEAR) { return sample_bilinear(sp.p_uv, level); }
+            if (sp.psm == P_NEAREST) { return sample_at<P_NEAREST, L_NEAREST>(sp.p_uv, level); }
+            else if (sp.psm == P_LINEAR) { return sample_at<P_LINEAR, L_NEAREST>(sp.p_uv, level); }
         } else if (sp.lsm == L_LINEAR) {
-            float weight = ceil(level) - level;
-            Color color;
-            if (sp.psm == P_NEAREST) {
-                color = weight * sample_nearest(sp.p_uv, floor(level));
-                color += (1 - weight) * sample_nearest(sp.p_uv, ceil(level));
-            } else if (sp.psm == P_LINEAR) {
-                color = weight * sample_bilinear(sp.p_uv, floor(level));
-                color += (1 - weight) * sample_bilinear(sp.p_uv, ceil(level));
-            }
-            return color;
+            if (sp.psm == P_NEAREST) { return sample_at<P_NEAREST, L_LINEAR>(sp.p_uv, level); }
+            else if (sp.psm == P_LINEAR) { return sample_at<P_LINEAR, L_LINEAR>(sp.p_uv, level); }
         }
         return Color(1,0,1);
     }
@@ -37,21 +42,128 @@ namespace CGL {
         Vector2D dy = sp.p_dy_uv - sp.p_uv;
         dx *= width - 1;
         dy *= height - 1;
-        float D = log(max(sqrt(dx[0] * dx[0] + dx[1] * dx[1]), sqrt(dy[0] * dy[0] + dy[1] * dy[1])));
+        float D = log2(max(sqrt(dx[0] * dx[0] + dx[1] * dx[1]), sqrt(dy[0] * dy[0] + dy[1] * dy[1])));
+        return max(D, (float) 0.0);
+    }
+
+    AnisoFootprint Texture::get_footprint(Vector2D dx_uv, Vector2D dy_uv, unsigned int max_aniso) {
+        // footprint axes in texels of level zero
+        Vector2D dx(dx_uv.x * (width - 1), dx_uv.y * (height - 1));
+        Vector2D dy(dy_uv.x * (width - 1), dy_uv.y * (height - 1));
+        double lx = dx.norm(), ly = dy.norm();
+        double major = max(lx, ly), minor = min(lx, ly);
+
+        AnisoFootprint fp;
+        fp.probes = 1;
+        if (major > 0) {
+            double ratio = minor > 0 ? major / minor : INF_D;
+            fp.probes = (int)min(ceil(ratio), (double)max(max_aniso, 1u));
+        }
+
+        // Spread the probes evenly over the major axis. Each one only has to
+        // cover major / probes texels, which picks a sharper level than the
+        // isotropic modes would; with the ratio capped that is no less than
+        // the minor axis.
+        fp.step = (lx >= ly ? dx_uv : dy_uv) / fp.probes;
+        fp.level = major > 0 ? max(0.0, log2(major / fp.probes)) : 0;
+        return fp;
+    }
+
+    void Texture::sample_quads(const SampleQuad* quads, size_t count, QuadColors* out,
+                               PixelSampleMethod psm, LevelSampleMethod lsm,
+                               unsigned int max_aniso) {
+        if (lsm == L_ANISOTROPIC) {
+            if (psm == P_NEAREST) { sample_quads<P_NEAREST, L_ANISOTROPIC>(quads, count, out, max_aniso); }
+            else if (psm == P_LINEAR) { sample_quads<P_LINEAR, L_ANISOTROPIC>(quads, count, out, max_aniso); }
+        } else if (lsm == L_ZERO) {
+            if (psm == P_NEAREST) { sample_quads<P_NEAREST, L_ZERO>(quads, count, out); }
+            else if (psm == P_LINEAR) { sample_quads<P_LINEAR, L_ZERO>(quads, count, out); }
+        } else if (lsm == L_NEAREST) {
+            if (psm == P_NEAREST) { sample_quads<P_NEAREST, L_NEAREST>(quads, count, out); }
+            else if (psm == P_LINEAR) { sample_quads<P_LINEAR, L_NEAREST>(quads, count, out); }
+        } else if (lsm == L_LINEAR) {
+            if (psm == P_NEAREST) { sample_quads<P_NEAREST, L_LINEAR>(quads, count, out); }
+            else if (psm == P_LINEAR) { sample_quads<P_LINEAR, L_LINEAR>(quads, count, out); }
+        }
+    }
+
+    float Texture::get_quad_level(const SampleQuad& quad) {
+        // samples 1 and 2 are the +x and +y neighbours of sample 0
+        Vector2D dx(quad.u[1] - quad.u[0], quad.v[1] - quad.v[0]);
+        Vector2D dy(quad.u[2] - quad.u[0], quad.v[2] - quad.v[0]);
+        dx *= width - 1;
+        dy *= height - 1;
+        float D = log2(max(sqrt(dx[0] * dx[0] + dx[1] * dx[1]), sqrt(dy[0] * dy[0] + dy[1] * dy[1])));
         return max(D, (float) 0.0);
     }
 
-    Color MipLevel::get_texel(int tx, int ty) {
-        return Color(&texels[tx * 3 + ty * width * 3]);
+    size_t Texture::memory_footprint() {
+        std::lock_guard<std::mutex> guard(mip_lock);
+        size_t bytes = 0;
+        for (size_t i = 0; i < mipmap.size(); ++i)
+            bytes += mipmap[i].texels.size();
+        return bytes;
+    }
+
+    size_t Texture::full_footprint() {
+        std::lock_guard<std::mutex> guard(mip_lock);
+        size_t bytes = 0;
+        for (size_t i = 0; i < mipmap.size(); ++i)
+            bytes += mipmap[i].stored_bytes();
+        return bytes;
+    }
+
+    TexelLayout Texture::default_layout = TEXELS_LINEAR;
+
+    void MipLevel::store(const std::vector<unsigned char>& rgb) {
+        if (layout == TEXELS_LINEAR) {
+            texels = rgb;
+            return;
+        }
+
+        // pad to whole tiles so every tile is a full 64 bytes
+        size_t tiledWidth = (width + 3) & ~(size_t)3;
+        size_t tiledHeight = (height + 3) & ~(size_t)3;
+        texels.assign(4 * tiledWidth * tiledHeight, 255);
+        for (size_t y = 0; y < height; y++) {
+            for (size_t x = 0; x < width; x++) {
+                unsigned char* t = &texels[4 * tiled_index(x, y)];
+                const unsigned char* p = &rgb[3 * (y * width + x)];
+                t[0] = p[0]; t[1] = p[1]; t[2] = p[2];
+            }
+        }
+    }
+
+    size_t MipLevel::stored_bytes() const {
+        if (layout == TEXELS_LINEAR) return 3 * width * height;
+        return 4 * ((width + 3) & ~(size_t)3) * ((height + 3) & ~(size_t)3);
+    }
+
+    std::vector<unsigned char> MipLevel::rgb() const {
+        if (layout == TEXELS_LINEAR) return texels;
+
+        std::vector<unsigned char> out(3 * width * height);
+        for (size_t y = 0; y < height; y++) {
+            for (size_t x = 0; x < width; x++) {
+                const unsigned char* t = &texels[4 * tiled_index(x, y)];
+                unsigned char* p = &out[3 * (y * width + x)];
+                p[0] = t[0]; p[1] = t[1]; p[2] = t[2];
+            }
+        }
+        return out;
     }
 
     Color Texture::sample_nearest(Vector2D uv, int level) {
         // return magenta for invalid level
         if (level >= mipmap.size()) return Color(1, 0, 1);
+        ensure_level(level);
+        STATS_ADD(texture_taps, 1);
+        STATS_ADD(mip_lookups[min(level, RenderStats::kMipLevels - 1)], 1);
 
         auto& mip = mipmap[level];
-        uv.x *= mip.width - 1;
-        uv.y *= mip.height - 1;
+        // samples on a triangle edge can land just outside [0, 1]
+        uv.x = clamp(uv.x, 0.0, 1.0) * (mip.width - 1);
+        uv.y = clamp(uv.y, 0.0, 1.0) * (mip.height - 1);
 
         return mip.get_texel(round(uv.x), round(uv.y));
     }
@@ -62,13 +174,18 @@ namespace CGL {
         int x0, x1, y0, y1;
         int s, t;
 
-        auto& mip = mipmap[level];
         // return magenta for invalid level
         if (level >= mipmap.size()) return Color(1, 0, 1);
+        ensure_level(level);
+        STATS_ADD(texture_taps, 4);
+        STATS_ADD(mip_lookups[min(level, RenderStats::kMipLevels - 1)], 1);
 
-        // scale by miplevel dimensions
-        uv.x *= mip.width - 1;
-        uv.y *= mip.height - 1;
+        auto& mip = mipmap[level];
+
+        // scale by miplevel dimensions, keeping samples that land just
+        // outside [0, 1] on the texture
+        uv.x = clamp(uv.x, 0.0, 1.0) * (mip.width - 1);
+        uv.y = clamp(uv.y, 0.0, 1.0) * (mip.height - 1);
 
         // 4 nearest texels
         x0 = floor(uv.x);
@@ -95,18 +212,167 @@ namespace CGL {
 
     // Helpers
 
-    inline void uint8_to_float(float dst[3], unsigned char* src) {
-        uint8_t* src_uint8 = (uint8_t*)src;
-        dst[0] = src_uint8[0] / 255.f;
-        dst[1] = src_uint8[1] / 255.f;
-        dst[2] = src_uint8[2] / 255.f;
+    // Mip levels with fewer texels than this are filtered on the calling thread
+    static const size_t kParallelMipTexels = 256 * 256;
+
+    // Filter taps along one axis of a downsampling step
+    struct MipTaps {
+        int support;
+        float weight[3];
+    };
+
+    // Taps for output index i when an axis shrinks from prevSize to currSize.
+    // An axis that is not reduced (already size 1) takes a single tap.
+    // Even sizes use a box filter of width 2; odd sizes are rounded down and
+    // use a trapezoidal filter of width 3.
+    static MipTaps mip_taps(int prevSize, int currSize, int i) {
+        MipTaps taps;
+        if (prevSize == currSize) {
+            taps.support = 1;
+            taps.weight[0] = 1.0f;
+        } else if (!(prevSize & 1)) {
+            taps.support = 2;
+            taps.weight[0] = taps.weight[1] = 0.5f;
+        } else {
+            float decimal = 1.0f / (float)currSize;
+            float norm = 1.0f / (2.0f + decimal);
+            taps.support = 3;
+            taps.weight[0] = norm * (1.0f - decimal * i);
+            taps.weight[1] = norm;
+            taps.weight[2] = norm * decimal * (i + 1);
+        }
+        return taps;
+    }
+
+    // Splits [0, rows) into contiguous row ranges and filters them on
+    // separate threads. Small levels are not worth the thread startup.
+    static void parallel_rows(int rows, size_t texels, const std::function<void(int, int)>& body) {
+        int threads = (int)std::thread::hardware_concurrency();
+        if (texels < kParallelMipTexels || threads <= 1 || rows < 2) {
+            body(0, rows);
+            return;
+        }
+
+        threads = min(threads, rows);
+        int chunk = (rows + threads - 1) / threads;
+        vector<std::thread> workers;
+        for (int begin = chunk; begin < rows; begin += chunk)
+            workers.emplace_back(body, begin, min(rows, begin + chunk));
+        body(0, min(rows, chunk));
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+    // 2x2 box filter, used when the previous level has even width and height.
+    // Sums are kept in integers and rounded to nearest.
+    static void downsample_box(const MipLevel& prev, MipLevel& curr, int rowBegin, int rowEnd) {
+        size_t prevPitch = prev.width * 3;
+        size_t currPitch = curr.width * 3;
+        int width = curr.width;
+
+#ifdef __SSSE3__
+        // gather the channels of the even / odd input texels of a 4 texel
+        // (12 byte) group into 16 bit lanes
+        const __m128i even = _mm_setr_epi8(0, -1, 1, -1, 2, -1, 6, -1, 7, -1, 8, -1, -1, -1, -1, -1);
+        const __m128i odd = _mm_setr_epi8(3, -1, 4, -1, 5, -1, 9, -1, 10, -1, 11, -1, -1, -1, -1, -1);
+        // drop the unused lanes after packing two groups back to bytes
+        const __m128i compact = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, -1, -1, -1, -1);
+        const __m128i two = _mm_set1_epi16(2);
+#endif
+
+        for (int j = rowBegin; j < rowEnd; j++) {
+            const unsigned char* row0 = &prev.texels[prevPitch * 2 * j];
+            const unsigned char* row1 = row0 + prevPitch;
+            unsigned char* out = &curr.texels[currPitch * j];
+
+            int i = 0;
+#ifdef __SSSE3__
+            // 4 output texels per iteration. The second pair of loads reads
+            // up to byte 6 * i + 28 of the input rows, hence the bound.
+            for (; i + 5 <= width; i += 4) {
+                const unsigned char* p0 = row0 + 6 * i;
+                const unsigned char* p1 = row1 + 6 * i;
+
+                __m128i a0 = _mm_loadu_si128((const __m128i*)p0);
+                __m128i a1 = _mm_loadu_si128((const __m128i*)p1);
+                __m128i b0 = _mm_loadu_si128((const __m128i*)(p0 + 12));
+                __m128i b1 = _mm_loadu_si128((const __m128i*)(p1 + 12));
+
+                __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_shuffle_epi8(a0, even), _mm_shuffle_epi8(a0, odd)),
+                                           _mm_add_epi16(_mm_shuffle_epi8(a1, even), _mm_shuffle_epi8(a1, odd)));
+                __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_shuffle_epi8(b0, even), _mm_shuffle_epi8(b0, odd)),
+                                           _mm_add_epi16(_mm_shuffle_epi8(b1, even), _mm_shuffle_epi8(b1, odd)));
+                lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+                hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+
+                __m128i result = _mm_shuffle_epi8(_mm_packus_epi16(lo, hi), compact);
+                _mm_storel_epi64((__m128i*)(out + 3 * i), result);
+                int tail = _mm_cvtsi128_si32(_mm_srli_si128(result, 8));
+                memcpy(out + 3 * i + 8, &tail, 4);
+            }
+#endif
+            for (; i < width; i++) {
+                const unsigned char* p0 = row0 + 6 * i;
+                const unsigned char* p1 = row1 + 6 * i;
+                for (int k = 0; k < 3; k++)
+                    out[3 * i + k] = (p0[k] + p0[k + 3] + p1[k] + p1[k + 3] + 2) >> 2;
+            }
+        }
+    }
+
+    // General separable filter for odd sized levels and levels that only
+    // shrink along one axis.
+    static void downsample_filtered(const MipLevel& prev, MipLevel& curr,
+                                    const vector<MipTaps>& wTaps, int rowBegin, int rowEnd) {
+        const float inv255 = 1.0f / 255.0f;
+        size_t prevPitch = prev.width * 3;
+        size_t currPitch = curr.width * 3;
+        int xStep = prev.width == curr.width ? 1 : 2;
+        int yStep = prev.height == curr.height ? 1 : 2;
+
+        for (int j = rowBegin; j < rowEnd; j++) {
+            MipTaps hTaps = mip_taps(prev.height, curr.height, j);
+            unsigned char* out = &curr.texels[currPitch * j];
+
+            for (int i = 0; i < curr.width; i++) {
+                const MipTaps& w = wTaps[i];
+                float result[3] = { 0.0f, 0.0f, 0.0f };
+
+                for (int jj = 0; jj < hTaps.support; jj++) {
+                    const unsigned char* in = &prev.texels[prevPitch * (yStep * j + jj) + 3 * xStep * i];
+                    for (int ii = 0; ii < w.support; ii++) {
+                        float weight = hTaps.weight[jj] * w.weight[ii] * inv255;
+                        result[0] += weight * in[3 * ii + 0];
+                        result[1] += weight * in[3 * ii + 1];
+                        result[2] += weight * in[3 * ii + 2];
+                    }
+                }
+
+                for (int k = 0; k < 3; k++)
+                    out[3 * i + k] = (uint8_t)(255.f * max(0.0f, min(1.0f, result[k])) + 0.5f);
+            }
+        }
     }
 
-    inline void float_to_uint8(unsigned char* dst, float src[3]) {
-        uint8_t* dst_uint8 = (uint8_t*)dst;
-        dst_uint8[0] = (uint8_t)(255.f * max(0.0f, min(1.0f, src[0])));
-        dst_uint8[1] = (uint8_t)(255.f * max(0.0f, min(1.0f, src[1])));
-        dst_uint8[2] = (uint8_t)(255.f * max(0.0f, min(1.0f, src[2])));
+    // Fills curr by downsampling prev, whose texels must already be valid.
+    static void downsample_level(const MipLevel& prev, MipLevel& curr) {
+        size_t texels = curr.width * curr.height;
+
+        if (!(prev.width & 1) && !(prev.height & 1)) {
+            parallel_rows(curr.height, texels, [&](int begin, int end) {
+                downsample_box(prev, curr, begin, end);
+            });
+            return;
+        }
+
+        // horizontal weights only depend on the column, so compute them once
+        vector<MipTaps> wTaps(curr.width);
+        for (int i = 0; i < curr.width; i++)
+            wTaps[i] = mip_taps(prev.width, curr.width, i);
+
+        parallel_rows(curr.height, texels, [&](int begin, int end) {
+            downsample_filtered(prev, curr, wTaps, begin, end);
+        });
     }
 
     // Linear interpolation helper
@@ -114,13 +380,16 @@ namespace CGL {
         return v0 + x * (v1 + (-1 * v0));
     }
 
-    void Texture::generate_mips(int startLevel) {
+    void Texture::allocate_mips(int startLevel) {
 
         // make sure there's a valid texture
         if (startLevel >= mipmap.size()) {
             std::cerr << "Invalid start level";
+            return;
         }
 
+        std::lock_guard<std::mutex> guard(mip_lock);
+
         // allocate sublevels
         int baseWidth = mipmap[startLevel].width;
         int baseHeight = mipmap[startLevel].height;
@@ -143,137 +412,51 @@ namespace CGL {
 
             level.width = width;
             level.height = height;
-            level.texels = vector<unsigned char>(3 * width * height);
+            level.layout = layout;
+            level.texels.clear();
         }
 
-        // create mips
-        int subLevels = numSubLevels - (startLevel + 1);
-        for (int mipLevel = startLevel + 1; mipLevel < startLevel + subLevels + 1;
-             mipLevel++) {
-
-            MipLevel& prevLevel = mipmap[mipLevel - 1];
-            MipLevel& currLevel = mipmap[mipLevel];
-
-            int prevLevelPitch = prevLevel.width * 3; // 32 bit RGB
-            int currLevelPitch = currLevel.width * 3; // 32 bit RGB
-
-            unsigned char* prevLevelMem;
-            unsigned char* currLevelMem;
-
-            currLevelMem = (unsigned char*)&currLevel.texels[0];
-            prevLevelMem = (unsigned char*)&prevLevel.texels[0];
-
-            float wDecimal, wNorm, wWeight[3];
-            int wSupport;
-            float hDecimal, hNorm, hWeight[3];
-            int hSupport;
-
-            float result[3];
-            float input[3];
-
-            // conditional differentiates no rounding case from round down case
-            if (prevLevel.width & 1) {
-                wSupport = 3;
-                wDecimal = 1.0f / (float)currLevel.width;
-            }
-            else {
-                wSupport = 2;
-                wDecimal = 0.0f;
-            }
-
-            // conditional differentiates no rounding case from round down case
-            if (prevLevel.height & 1) {
-                hSupport = 3;
-                hDecimal = 1.0f / (float)currLevel.height;
-            }
-            else {
-                hSupport = 2;
-                hDecimal = 0.0f;
-            }
-
-            wNorm = 1.0f / (2.0f + wDecimal);
-            hNorm = 1.0f / (2.0f + hDecimal);
-
-            // case 1: reduction only in horizontal size (vertical size is 1)
-            if (currLevel.height == prevLevel.height) {
-                //assert (currLevel.height == 1);
-
-                for (int i = 0; i < currLevel.width; i++) {
-                    wWeight[0] = wNorm * (1.0f - wDecimal * i);
-                    wWeight[1] = wNorm * 1.0f;
-                    wWeight[2] = wNorm * wDecimal * (i + 1);
-
-                    result[0] = result[1] = result[2] = 0.0f;
-
-                    for (int ii = 0; ii < wSupport; ii++) {
-                        uint8_to_float(input, prevLevelMem + 3 * (2 * i + ii));
-                        result[0] += wWeight[ii] * input[0];
-                        result[1] += wWeight[ii] * input[1];
-                        result[2] += wWeight[ii] * input[2];
-                    }
+        resident_levels.store(startLevel + 1, std::memory_order_release);
+    }
 
-                    // convert back to format of the texture
-                    float_to_uint8(currLevelMem + (3 * i), result);
-                }
+    void Texture::generate_mips(int startLevel) {
+        allocate_mips(startLevel);
+        ensure_level((int)mipmap.size() - 1);
+    }
 
-                // case 2: reduction only in vertical size (horizontal size is 1)
-            }
-            else if (currLevel.width == prevLevel.width) {
-                //assert (currLevel.width == 1);
-
-                for (int j = 0; j < currLevel.height; j++) {
-                    hWeight[0] = hNorm * (1.0f - hDecimal * j);
-                    hWeight[1] = hNorm;
-                    hWeight[2] = hNorm * hDecimal * (j + 1);
-
-                    result[0] = result[1] = result[2] = 0.0f;
-                    for (int jj = 0; jj < hSupport; jj++) {
-                        uint8_to_float(input, prevLevelMem + prevLevelPitch * (2 * j + jj));
-                        result[0] += hWeight[jj] * input[0];
-                        result[1] += hWeight[jj] * input[1];
-                        result[2] += hWeight[jj] * input[2];
-                    }
+    void Texture::generate_levels(int level) {
+        std::lock_guard<std::mutex> guard(mip_lock);
+        STATS_TIME(MIPMAP);
 
-                    // convert back to format of the texture
-                    float_to_uint8(currLevelMem + (currLevelPitch * j), result);
-                }
+        // another sampler may have generated the level while we waited
+        int resident = resident_levels.load(std::memory_order_relaxed);
+        level = min(level, (int)mipmap.size() - 1);
 
-                // case 3: reduction in both horizontal and vertical size
+        // create mips, each from the one above it
+        if (layout == TEXELS_LINEAR) {
+            for (int mipLevel = max(resident, 1); mipLevel <= level; mipLevel++) {
+                MipLevel& curr = mipmap[mipLevel];
+                curr.texels.resize(3 * curr.width * curr.height);
+                downsample_level(mipmap[mipLevel - 1], curr);
             }
-            else {
-
-                for (int j = 0; j < currLevel.height; j++) {
-                    hWeight[0] = hNorm * (1.0f - hDecimal * j);
-                    hWeight[1] = hNorm;
-                    hWeight[2] = hNorm * hDecimal * (j + 1);
-
-                    for (int i = 0; i < currLevel.width; i++) {
-                        wWeight[0] = wNorm * (1.0f - wDecimal * i);
-                        wWeight[1] = wNorm * 1.0f;
-                        wWeight[2] = wNorm * wDecimal * (i + 1);
-
-                        result[0] = result[1] = result[2] = 0.0f;
-
-                        // convolve source image with a trapezoidal filter.
-                        // in the case of no rounding this is just a box filter of width 2.
-                        // in the general case, the support region is 3x3.
-                        for (int jj = 0; jj < hSupport; jj++)
-                            for (int ii = 0; ii < wSupport; ii++) {
-                                float weight = hWeight[jj] * wWeight[ii];
-                                uint8_to_float(input, prevLevelMem +
-                                                      prevLevelPitch * (2 * j + jj) +
-                                                      3 * (2 * i + ii));
-                                result[0] += weight * input[0];
-                                result[1] += weight * input[1];
-                                result[2] += weight * input[2];
-                            }
-
-                        // convert back to format of the texture
-                        float_to_uint8(currLevelMem + currLevelPitch * j + 3 * i, result);
-                    }
-                }
+        } else if (level >= resident) {
+            // the filters work on row-major RGB, so carry a linear copy of
+            // the previous level down the chain
+            int first = max(resident, 1);
+            const MipLevel& top = mipmap[first - 1];
+            MipLevel prev = { top.width, top.height, top.rgb(), TEXELS_LINEAR };
+            for (int mipLevel = first; mipLevel <= level; mipLevel++) {
+                MipLevel& curr = mipmap[mipLevel];
+                MipLevel next = { curr.width, curr.height,
+                                  vector<unsigned char>(3 * curr.width * curr.height), TEXELS_LINEAR };
+                downsample_level(prev, next);
+                curr.store(next.texels);
+                std::swap(prev, next);
             }
         }
+
+        if (level >= resident)
+            resident_levels.store(level + 1, std::memory_order_release);
     }
 
 }
@@ -2,6 +2,8 @@
 #define CGL_TEXTURE_H
 
 #include <vector>
+#include <atomic>
+#include <mutex>
 #include "CGL/CGL.h"
 #include "CGL/color.h"
 #include "CGL/vector2D.h"
@@ -12,56 +14,242 @@ using namespace std;
 namespace CGL {
 
 typedef enum PixelSampleMethod { P_NEAREST = 0, P_LINEAR = 1 } PixelSampleMethod;
-typedef enum LevelSampleMethod { L_ZERO = 0, L_NEAREST = 1, L_LINEAR = 2 } LevelSampleMethod;
+typedef enum LevelSampleMethod { L_ZERO = 0, L_NEAREST = 1, L_LINEAR = 2, L_ANISOTROPIC = 3 } LevelSampleMethod;
+
+// Default upper bound on the number of probes of L_ANISOTROPIC sampling
+static const unsigned int kDefaultMaxAnisotropy = 8;
 
 struct SampleParams {
   Vector2D p_uv;
   Vector2D p_dx_uv, p_dy_uv;
   PixelSampleMethod psm;
   LevelSampleMethod lsm;
+  // Most probes L_ANISOTROPIC may take along the footprint's major axis
+  unsigned int max_aniso;
+};
+
+// Where and how L_ANISOTROPIC probes a texture for one sample: probes
+// spaced step apart along the major axis of the sample's footprint, each a
+// trilinear lookup at level, which is chosen from the minor axis.
+struct AnisoFootprint {
+  Vector2D step;
+  int probes;
+  float level;
+};
+
+// A 2x2 quad of texture coordinates, structure-of-arrays, for the samples
+// at (x, y), (x + 1, y), (x, y + 1) and (x + 1, y + 1) in screen space.
+struct SampleQuad {
+  double u[4];
+  double v[4];
+};
+
+// The colors sampled for a quad, structure-of-arrays
+struct QuadColors {
+  float r[4];
+  float g[4];
+  float b[4];
 };
 
 static const int kMaxMipLevels = 14;
 
+// Storage order of the texels of a mip level.
+// TEXELS_LINEAR packs RGB texels row by row.
+// TEXELS_TILED stores RGBA texels in 4x4 tiles of 64 bytes, in Morton (Z)
+// order within a tile, so the taps of a bilinear footprint usually share a
+// cache line whatever the orientation of the triangle being textured.
+typedef enum TexelLayout { TEXELS_LINEAR = 0, TEXELS_TILED = 1 } TexelLayout;
+
 struct MipLevel {
 	size_t width;
 	size_t height;
-  // RGB color values
+  // Color values in the given layout. Empty until the level has been generated.
   std::vector<unsigned char> texels;
+  TexelLayout layout;
+
+  inline Color get_texel(int tx, int ty) {
+    if (layout == TEXELS_TILED)
+      return Color(&texels[4 * tiled_index(tx, ty)]);
+    return Color(&texels[tx * 3 + ty * width * 3]);
+  }
 
-  Color get_texel(int tx, int ty);
+  // Position of texel (tx, ty) in the tiled layout
+  inline size_t tiled_index(int tx, int ty) const {
+    size_t tile = (ty >> 2) * ((width + 3) >> 2) + (tx >> 2);
+    int x = tx & 3, y = ty & 3;
+    return (tile << 4) | (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2);
+  }
+
+  // Replaces the texels with row-major RGB data, converted to this level's layout
+  void store(const std::vector<unsigned char>& rgb);
+
+  // Returns the texels as row-major RGB data
+  std::vector<unsigned char> rgb() const;
+
+  // Bytes the texels take once the level has been generated
+  size_t stored_bytes() const;
 };
 
 struct Texture {
   size_t width;
   size_t height;
+  TexelLayout layout;
   std::vector<MipLevel> mipmap;
 
-  void init(const vector<unsigned char>& pixels, const size_t& w, const size_t& h) {
-    width = w; height = h;
+  // Layout used by init when none is given
+  static TexelLayout default_layout;
+
+  Texture() : width(0), height(0), layout(TEXELS_LINEAR), resident_levels(0) { }
+
+  void init(const vector<unsigned char>& pixels, const size_t& w, const size_t& h,
+            TexelLayout texel_layout = default_layout) {
+    width = w; height = h; layout = texel_layout;
 
     // A fancy C++11 feature. emplace_back constructs the element in place,
     // and in this case it uses the new {} list constructor syntax.
-    mipmap.emplace_back(MipLevel{width, height, pixels});
+    mipmap.emplace_back(MipLevel{width, height, vector<unsigned char>(), layout});
+    mipmap[0].store(pixels);
 
-    generate_mips();
+    // Sublevels are only sized here. Their texels are filtered the first
+    // time a sampler touches them (see ensure_level).
+    allocate_mips();
   }
 
   // Linear interpolation helper
   Color lerp(float x, Color v0, Color v1);
 
-  // Generates up to kMaxMipLevels of mip maps. Level 0 contains
-  // the unfiltered original pixels.
+  // Sizes up to kMaxMipLevels of mip maps below startLevel without
+  // generating their texels. Level 0 contains the unfiltered original pixels.
+  void allocate_mips(int startLevel = 0);
+
+  // Generates up to kMaxMipLevels of mip maps eagerly.
   void generate_mips(int startLevel = 0);
 
+  // Makes sure the texels of every level up to and including level have
+  // been generated. Safe to call from several sampling threads at once.
+  inline void ensure_level(int level) {
+    if (level >= resident_levels.load(std::memory_order_acquire))
+      generate_levels(level);
+  }
+
   Color sample(const SampleParams &sp);
   float get_level(const SampleParams &sp);
 
+  // Samples a run of quads. Each quad's level of detail is computed once from
+  // the differences between its own samples, and the sampling methods are
+  // resolved once for the whole run rather than per sample.
+  void sample_quads(const SampleQuad* quads, size_t count, QuadColors* out,
+                    PixelSampleMethod psm, LevelSampleMethod lsm,
+                    unsigned int max_aniso = kDefaultMaxAnisotropy);
+
+  template <PixelSampleMethod psm, LevelSampleMethod lsm>
+  void sample_quads(const SampleQuad* quads, size_t count, QuadColors* out,
+                    unsigned int max_aniso = kDefaultMaxAnisotropy);
+
+  // Level of detail of a quad, as get_level would compute for its first sample
+  float get_quad_level(const SampleQuad& quad);
+
+  // Anisotropic footprint of a sample from its uv derivatives
+  AnisoFootprint get_footprint(Vector2D dx_uv, Vector2D dy_uv, unsigned int max_aniso);
+
+  // Averages trilinear probes across the footprint, centered at uv
+  template <PixelSampleMethod psm>
+  Color sample_aniso(Vector2D uv, const AnisoFootprint& fp);
+
+  // Samples at a known level of detail with the methods fixed at compile time.
+  // Not used for L_ANISOTROPIC, which needs the whole footprint.
+  template <PixelSampleMethod psm, LevelSampleMethod lsm>
+  Color sample_at(Vector2D uv, float level);
+
+  template <PixelSampleMethod psm>
+  Color sample_pixel(Vector2D uv, int level) {
+    return psm == P_NEAREST ? sample_nearest(uv, level) : sample_bilinear(uv, level);
+  }
+
   Color sample_nearest(Vector2D uv, int level = 0);
 
   Color sample_bilinear(Vector2D uv, int level = 0);
+
+  // Bytes of texel storage held across all mip levels
+  size_t memory_footprint();
+
+  // Bytes of texel storage all mip levels hold once generated, including
+  // those not generated yet
+  size_t full_footprint();
+
+ private:
+  // Slow path of ensure_level
+  void generate_levels(int level);
+
+  // Levels [0, resident_levels) have valid texels
+  std::atomic<int> resident_levels;
+  std::mutex mip_lock;
 };
 
+template <PixelSampleMethod psm, LevelSampleMethod lsm>
+Color Texture::sample_at(Vector2D uv, float level) {
+  if (lsm == L_ZERO)
+    return sample_pixel<psm>(uv, 0);
+  if (lsm == L_NEAREST)
+    return sample_pixel<psm>(uv, round(level));
+
+  float weight = ceil(level) - level;
+  Color color = weight * sample_pixel<psm>(uv, floor(level));
+  color += (1 - weight) * sample_pixel<psm>(uv, ceil(level));
+  return color;
+}
+
+template <PixelSampleMethod psm>
+Color Texture::sample_aniso(Vector2D uv, const AnisoFootprint& fp) {
+  int last = (int)mipmap.size() - 1;
+  int lo = min((int)floor(fp.level), last);
+  int hi = min((int)ceil(fp.level), last);
+  float weight = ceil(fp.level) - fp.level;
+
+  Color color(0, 0, 0, 0);
+  Vector2D p = uv - fp.step * ((fp.probes - 1) * 0.5);
+  for (int i = 0; i < fp.probes; ++i, p += fp.step) {
+    // probes near an edge must not step off the texture
+    Vector2D q(clamp(p.x, 0.0, 1.0), clamp(p.y, 0.0, 1.0));
+    color += weight * sample_pixel<psm>(q, lo);
+    color += (1 - weight) * sample_pixel<psm>(q, hi);
+  }
+  return color * (1.0f / fp.probes);
+}
+
+template <PixelSampleMethod psm, LevelSampleMethod lsm>
+void Texture::sample_quads(const SampleQuad* quads, size_t count, QuadColors* out,
+                           unsigned int max_aniso) {
+  for (size_t i = 0; i < count; ++i) {
+    const SampleQuad& q = quads[i];
+    QuadColors& c = out[i];
+
+    if (lsm == L_ANISOTROPIC) {
+      AnisoFootprint fp = get_footprint(Vector2D(q.u[1] - q.u[0], q.v[1] - q.v[0]),
+                                        Vector2D(q.u[2] - q.u[0], q.v[2] - q.v[0]), max_aniso);
+      for (int k = 0; k < 4; ++k) {
+        Color col = sample_aniso<psm>(Vector2D(q.u[k], q.v[k]), fp);
+        c.r[k] = col.r; c.g[k] = col.g; c.b[k] = col.b;
+      }
+      continue;
+    }
+
+    float level = get_quad_level(q);
+    if (level > mipmap.size()) {
+      // magenta for an invalid level, as in sample
+      for (int k = 0; k < 4; ++k) {
+        c.r[k] = 1; c.g[k] = 0; c.b[k] = 1;
+      }
+      continue;
+    }
+
+    for (int k = 0; k < 4; ++k) {
+      Color col = sample_at<psm, lsm>(Vector2D(q.u[k], q.v[k]), level);
+      c.r[k] = col.r; c.g[k] = col.g; c.b[k] = col.b;
+    }
+  }
+}
+
 }
 
 #endif // CGL_TEXTURE_H
@@ -0,0 +1,118 @@
+#include "texture_cache.h"
+
+#include <cstdio>
+#include <iostream>
+
+namespace CGL {
+
+std::mutex TextureCache::lock;
+std::map<std::string, TextureCache::Entry> TextureCache::entries;
+std::map<const Texture*, std::string> TextureCache::keys;
+std::list<std::string> TextureCache::lru;
+size_t TextureCache::budget = TextureCache::kDefaultBudget;
+size_t TextureCache::bytes = 0;
+
+std::string TextureCache::key_for(const unsigned char* data, size_t size) {
+  // 64-bit FNV-1a over the encoded bytes; the size is appended to the key
+  // to make accidental collisions between different images even less likely.
+  unsigned long long hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= data[i];
+    hash *= 1099511628211ULL;
+  }
+
+  char key[64];
+  snprintf(key, sizeof(key), "%016llx:%zu", hash, size);
+  return std::string(key);
+}
+
+Texture* TextureCache::acquire(const std::string& key) {
+  std::lock_guard<std::mutex> guard(lock);
+
+  std::map<std::string, Entry>::iterator it = entries.find(key);
+  if (it == entries.end()) return NULL;
+
+  Entry& e = it->second;
+  if (e.refs++ == 0) lru.erase(e.lru_pos);
+  return e.tex;
+}
+
+Texture* TextureCache::insert(const std::string& key, Texture* tex) {
+  std::lock_guard<std::mutex> guard(lock);
+
+  std::map<std::string, Entry>::iterator it = entries.find(key);
+  if (it != entries.end()) {
+    // lost a race against another loader of the same image
+    delete tex;
+    Entry& e = it->second;
+    if (e.refs++ == 0) lru.erase(e.lru_pos);
+    return e.tex;
+  }
+
+  Entry e;
+  e.tex = tex;
+  // charged for the whole mip chain up front, as its levels are only
+  // generated once they are sampled
+  e.bytes = tex->full_footprint();
+  e.refs = 1;
+  e.lru_pos = lru.end();
+  entries[key] = e;
+  keys[tex] = key;
+  bytes += e.bytes;
+
+  evict_to_budget();
+  return tex;
+}
+
+void TextureCache::release(Texture* tex) {
+  if (!tex) return;
+
+  std::lock_guard<std::mutex> guard(lock);
+
+  std::map<const Texture*, std::string>::iterator k = keys.find(tex);
+  if (k == keys.end()) {
+    std::cerr << "TextureCache: released a texture it does not own" << std::endl;
+    return;
+  }
+
+  Entry& e = entries[k->second];
+  if (--e.refs == 0) {
+    e.lru_pos = lru.insert(lru.end(), k->second);
+    evict_to_budget();
+  }
+}
+
+void TextureCache::set_budget(size_t bytes) {
+  std::lock_guard<std::mutex> guard(lock);
+  budget = bytes;
+  evict_to_budget();
+}
+
+size_t TextureCache::resident_bytes() {
+  std::lock_guard<std::mutex> guard(lock);
+  return bytes;
+}
+
+void TextureCache::purge() {
+  std::lock_guard<std::mutex> guard(lock);
+  size_t saved = budget;
+  budget = 0;
+  evict_to_budget();
+  budget = saved;
+}
+
+void TextureCache::evict_to_budget() {
+  // only unreferenced entries are on the LRU list, so textures still in
+  // use are never freed from under their owners
+  while (bytes > budget && !lru.empty()) {
+    std::map<std::string, Entry>::iterator it = entries.find(lru.front());
+    lru.pop_front();
+
+    bytes -= it->second.bytes;
+    keys.erase(it->second.tex);
+    delete it->second.tex;
+    entries.erase(it);
+  }
+}
+
+} // namespace CGL
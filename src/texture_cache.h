@@ -0,0 +1,79 @@
+#ifndef CGL_TEXTURE_CACHE_H
+#define CGL_TEXTURE_CACHE_H
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "texture.h"
+
+namespace CGL {
+
+/**
+ * Process-wide cache of decoded, mipmapped textures.
+ * Textures are keyed by a hash of their encoded (PNG) contents, so the same
+ * image referenced from several SVGs, or embedded in several <image> elements,
+ * is only decoded and mipmapped once. Entries are reference counted; once an
+ * entry is no longer referenced it stays resident until the cache grows past
+ * its memory budget, at which point the least recently released entries are
+ * evicted first.
+ */
+class TextureCache {
+ public:
+
+  // Default memory budget for unreferenced textures, in bytes.
+  static const size_t kDefaultBudget = 256 * 1024 * 1024;
+
+  // Builds the cache key for an encoded image buffer.
+  static std::string key_for(const unsigned char* data, size_t size);
+
+  // Returns the texture stored under key with one more reference taken,
+  // or NULL if the key is not resident.
+  static Texture* acquire(const std::string& key);
+
+  // Stores tex under key and returns it with one reference taken. The cache
+  // takes ownership of tex. If another thread inserted the same key first,
+  // tex is deleted and the resident texture is returned instead.
+  static Texture* insert(const std::string& key, Texture* tex);
+
+  // Drops one reference to a texture obtained from acquire or insert.
+  static void release(Texture* tex);
+
+  // Sets the memory budget and evicts unreferenced entries to fit it.
+  static void set_budget(size_t bytes);
+
+  // Total bytes of resident textures, referenced or not, each counted
+  // with its whole mip chain whether generated yet or not.
+  static size_t resident_bytes();
+
+  // Evicts every unreferenced entry.
+  static void purge();
+
+ private:
+
+  struct Entry {
+    Texture* tex;
+    size_t bytes;
+    int refs;
+    std::list<std::string>::iterator lru_pos;
+  };
+
+  // Must be called with lock held.
+  static void evict_to_budget();
+
+  static std::mutex lock;
+  static std::map<std::string, Entry> entries;
+  static std::map<const Texture*, std::string> keys;
+
+  // Keys of unreferenced entries, least recently released first.
+  static std::list<std::string> lru;
+
+  static size_t budget;
+  static size_t bytes;
+
+}; // class TextureCache
+
+} // namespace CGL
+
+#endif // CGL_TEXTURE_CACHE_H
@@ -7,6 +7,11 @@
 namespace CGL {
 
 Vector2D operator*(const Matrix3x3 &m, const Vector2D &v) {
+	// affine matrices need no homogeneous divide
+	if (m(2,0) == 0 && m(2,1) == 0 && m(2,2) == 1)
+		return Vector2D(v.x * m(0,0) + v.y * m(0,1) + m(0,2),
+		                v.x * m(1,0) + v.y * m(1,1) + m(1,2));
+
 	Vector3D mv = m * Vector3D(v.x, v.y, 1);
 	return Vector2D(mv.x / mv.z, mv.y / mv.z);
 }